@@ -0,0 +1,502 @@
+/*
+Copyright (c) 2018 Zhang Weijia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "pixpix.h"
+#include <cmath>
+#include <map>
+#include <algorithm>
+using namespace std;
+
+namespace pixpix {
+
+/* collects triangles and welds vertices sharing the same position */
+class MeshBuilder {
+private:
+    map<pair<pair<int, int>, int>, unsigned> weld;
+public:
+    MESH mesh;
+
+    MeshBuilder() {
+        mesh.verts = new vector<VEC3>;
+        mesh.faceIndex = new vector<unsigned>;
+        mesh.vertexIndex = new vector<unsigned>;
+        mesh.normal = new vector<VEC3>;
+        mesh.texCoord = new vector<VEC2>;
+    }
+
+    unsigned vertex(VEC3 p) {
+        const float q = 1e5f;
+        pair<pair<int, int>, int> key = make_pair(
+            make_pair((int)lroundf(p.x * q), (int)lroundf(p.y * q)), (int)lroundf(p.z * q));
+        map<pair<pair<int, int>, int>, unsigned>::iterator it = weld.find(key);
+        if (it != weld.end()) return it->second;
+        mesh.verts->push_back(p);
+        return weld[key] = mesh.verts->size() - 1;
+    }
+
+    /* counter-clockwise winding is front facing, corners are swapped when
+       the winding disagrees with the given normals; degenerate ones are
+       dropped */
+    void triangle(VEC3 p[3], VEC3 n[3], VEC2 t[3]) {
+        unsigned v[3] = {vertex(p[0]), vertex(p[1]), vertex(p[2])};
+        if (v[0] == v[1] || v[1] == v[2] || v[0] == v[2]) return;
+        int order[3] = {0, 1, 2};
+        VEC3 face = (p[1] - p[0]) ^ (p[2] - p[0]);
+        if (face * (n[0] + n[1] + n[2]) < 0) swap(order[1], order[2]);
+        mesh.faceIndex->push_back(3);
+        for (int i = 0; i < 3; ++i) {
+            mesh.vertexIndex->push_back(v[order[i]]);
+            mesh.normal->push_back(n[order[i]]);
+            mesh.texCoord->push_back(t[order[i]]);
+        }
+    }
+
+    /* quad a-b-c-d split along a-c */
+    void quad(VEC3 p[4], VEC3 n[4], VEC2 t[4]) {
+        VEC3 p1[3] = {p[0], p[1], p[2]}, n1[3] = {n[0], n[1], n[2]};
+        VEC2 t1[3] = {t[0], t[1], t[2]};
+        VEC3 p2[3] = {p[0], p[2], p[3]}, n2[3] = {n[0], n[2], n[3]};
+        VEC2 t2[3] = {t[0], t[2], t[3]};
+        triangle(p1, n1, t1);
+        triangle(p2, n2, t2);
+    }
+
+    MESH finish() {
+        Geometry::optimizeVertexCache(mesh);
+        return mesh;
+    }
+};
+
+/*!
+    \brief Axis aligned cube centered at the origin.
+    \param size: edge length
+    \param tess: quads per face edge
+*/
+MESH
+Geometry::cube(float size, unsigned tess) {
+    MeshBuilder b;
+    if (tess == 0) tess = 1;
+    float h = size / 2.0f;
+    /* normal, u axis, v axis of the six faces */
+    VEC3 faces[6][3] = {
+        {{ 1, 0, 0}, { 0, 0,-1}, { 0, 1, 0}},
+        {{-1, 0, 0}, { 0, 0, 1}, { 0, 1, 0}},
+        {{ 0, 1, 0}, { 1, 0, 0}, { 0, 0,-1}},
+        {{ 0,-1, 0}, { 1, 0, 0}, { 0, 0, 1}},
+        {{ 0, 0, 1}, { 1, 0, 0}, { 0, 1, 0}},
+        {{ 0, 0,-1}, {-1, 0, 0}, { 0, 1, 0}}
+    };
+    for (int f = 0; f < 6; ++f) {
+        VEC3 n = faces[f][0], u = faces[f][1], v = faces[f][2];
+        for (unsigned i = 0; i < tess; ++i) {
+            for (unsigned j = 0; j < tess; ++j) {
+                float s[4] = {(float)i/tess, (float)(i+1)/tess, (float)(i+1)/tess, (float)i/tess};
+                float t[4] = {(float)j/tess, (float)j/tess, (float)(j+1)/tess, (float)(j+1)/tess};
+                VEC3 p[4], nn[4];
+                VEC2 tc[4];
+                for (int k = 0; k < 4; ++k) {
+                    p[k] = n * h + u * ((s[k] * 2 - 1) * h) + v * ((t[k] * 2 - 1) * h);
+                    nn[k] = n;
+                    tc[k] = (VEC2){s[k], 1.0f - t[k]};
+                }
+                b.quad(p, nn, tc);
+            }
+        }
+    }
+    return b.finish();
+}
+
+/*!
+    \brief UV sphere centered at the origin, poles on the y axis.
+    \param slices: segments around the y axis
+    \param stacks: segments from pole to pole
+*/
+MESH
+Geometry::sphere(float radius, unsigned slices, unsigned stacks) {
+    MeshBuilder b;
+    if (slices < 3) slices = 3;
+    if (stacks < 2) stacks = 2;
+    for (unsigned i = 0; i < stacks; ++i) {
+        for (unsigned j = 0; j < slices; ++j) {
+            unsigned si[4] = {i, i+1, i+1, i}, sj[4] = {j, j, j+1, j+1};
+            VEC3 p[4], n[4];
+            VEC2 t[4];
+            for (int k = 0; k < 4; ++k) {
+                float theta = Math::Pi * si[k] / stacks;
+                float phi = 2.0f * Math::Pi * sj[k] / slices;
+                n[k] = (VEC3){sinf(theta) * cosf(phi), cosf(theta), -sinf(theta) * sinf(phi)};
+                p[k] = n[k] * radius;
+                t[k] = (VEC2){(float)sj[k] / slices, (float)si[k] / stacks};
+            }
+            b.quad(p, n, t);
+        }
+    }
+    return b.finish();
+}
+
+/*!
+    \brief Capped cylinder centered at the origin along the y axis.
+    \param slices: segments around the y axis
+    \param stacks: segments along the side
+*/
+MESH
+Geometry::cylinder(float radius, float height, unsigned slices, unsigned stacks) {
+    MeshBuilder b;
+    if (slices < 3) slices = 3;
+    if (stacks < 1) stacks = 1;
+    float h = height / 2.0f;
+    auto ring = [&](unsigned j) {
+        if (j == slices) j = 0;
+        float phi = 2.0f * Math::Pi * j / slices;
+        return (VEC3){cosf(phi), 0, -sinf(phi)};
+    };
+    /* side */
+    for (unsigned i = 0; i < stacks; ++i) {
+        for (unsigned j = 0; j < slices; ++j) {
+            unsigned si[4] = {i, i+1, i+1, i}, sj[4] = {j, j, j+1, j+1};
+            VEC3 p[4], n[4];
+            VEC2 t[4];
+            for (int k = 0; k < 4; ++k) {
+                n[k] = ring(sj[k]);
+                p[k] = n[k] * radius + (VEC3){0, h - height * si[k] / stacks, 0};
+                t[k] = (VEC2){(float)sj[k] / slices, (float)si[k] / stacks};
+            }
+            b.quad(p, n, t);
+        }
+    }
+    /* caps */
+    for (int cap = 0; cap < 2; ++cap) {
+        float y = cap ? -h : h;
+        VEC3 n = (VEC3){0, cap ? -1.0f : 1.0f, 0};
+        for (unsigned j = 0; j < slices; ++j) {
+            VEC3 r0 = ring(j), r1 = ring(j+1);
+            VEC3 p[3] = {{0, y, 0}, r0 * radius + (VEC3){0, y, 0}, r1 * radius + (VEC3){0, y, 0}};
+            VEC3 nn[3] = {n, n, n};
+            VEC2 t[3] = {{0.5f, 0.5f}, {0.5f + r0.x / 2, 0.5f + r0.z / 2},
+                         {0.5f + r1.x / 2, 0.5f + r1.z / 2}};
+            b.triangle(p, nn, t);
+        }
+    }
+    return b.finish();
+}
+
+/* Newell's teapot, the reduced patch set shipped with GLUT. The first six
+   patches are mirrored into all four quadrants, handle and spout only
+   across the xz plane. The data is z-up. */
+static const int teapotPatch[10][16] = {
+    /* rim */
+    {102, 103, 104, 105, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    /* body */
+    {12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27},
+    {24, 25, 26, 27, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40},
+    /* lid */
+    {96, 96, 96, 96, 97, 98, 99, 100, 101, 101, 101, 101, 0, 1, 2, 3},
+    {0, 1, 2, 3, 106, 107, 108, 109, 110, 111, 112, 113, 114, 115, 116, 117},
+    /* bottom */
+    {118, 118, 118, 118, 124, 122, 119, 121, 123, 126, 125, 120, 40, 39, 38, 37},
+    /* handle */
+    {41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56},
+    {53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 28, 65, 66, 67},
+    /* spout */
+    {68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79, 80, 81, 82, 83},
+    {80, 81, 82, 83, 84, 85, 86, 87, 88, 89, 90, 91, 92, 93, 94, 95}
+};
+
+static const float teapotPoint[127][3] = {
+    {0.2f, 0, 2.7f}, {0.2f, -0.112f, 2.7f}, {0.112f, -0.2f, 2.7f}, {0, -0.2f, 2.7f},
+    {1.3375f, 0, 2.53125f}, {1.3375f, -0.749f, 2.53125f}, {0.749f, -1.3375f, 2.53125f}, {0, -1.3375f, 2.53125f},
+    {1.4375f, 0, 2.53125f}, {1.4375f, -0.805f, 2.53125f}, {0.805f, -1.4375f, 2.53125f}, {0, -1.4375f, 2.53125f},
+    {1.5f, 0, 2.4f}, {1.5f, -0.84f, 2.4f}, {0.84f, -1.5f, 2.4f}, {0, -1.5f, 2.4f},
+    {1.75f, 0, 1.875f}, {1.75f, -0.98f, 1.875f}, {0.98f, -1.75f, 1.875f}, {0, -1.75f, 1.875f},
+    {2, 0, 1.35f}, {2, -1.12f, 1.35f}, {1.12f, -2, 1.35f}, {0, -2, 1.35f},
+    {2, 0, 0.9f}, {2, -1.12f, 0.9f}, {1.12f, -2, 0.9f}, {0, -2, 0.9f},
+    {-2, 0, 0.9f}, {2, 0, 0.45f}, {2, -1.12f, 0.45f}, {1.12f, -2, 0.45f},
+    {0, -2, 0.45f}, {1.5f, 0, 0.225f}, {1.5f, -0.84f, 0.225f}, {0.84f, -1.5f, 0.225f},
+    {0, -1.5f, 0.225f}, {1.5f, 0, 0.15f}, {1.5f, -0.84f, 0.15f}, {0.84f, -1.5f, 0.15f},
+    {0, -1.5f, 0.15f}, {-1.6f, 0, 2.025f}, {-1.6f, -0.3f, 2.025f}, {-1.5f, -0.3f, 2.25f},
+    {-1.5f, 0, 2.25f}, {-2.3f, 0, 2.025f}, {-2.3f, -0.3f, 2.025f}, {-2.5f, -0.3f, 2.25f},
+    {-2.5f, 0, 2.25f}, {-2.7f, 0, 2.025f}, {-2.7f, -0.3f, 2.025f}, {-3, -0.3f, 2.25f},
+    {-3, 0, 2.25f}, {-2.7f, 0, 1.8f}, {-2.7f, -0.3f, 1.8f}, {-3, -0.3f, 1.8f},
+    {-3, 0, 1.8f}, {-2.7f, 0, 1.575f}, {-2.7f, -0.3f, 1.575f}, {-3, -0.3f, 1.35f},
+    {-3, 0, 1.35f}, {-2.5f, 0, 1.125f}, {-2.5f, -0.3f, 1.125f}, {-2.65f, -0.3f, 0.9375f},
+    {-2.65f, 0, 0.9375f}, {-2, -0.3f, 0.9f}, {-1.9f, -0.3f, 0.6f}, {-1.9f, 0, 0.6f},
+    {1.7f, 0, 1.425f}, {1.7f, -0.66f, 1.425f}, {1.7f, -0.66f, 0.6f}, {1.7f, 0, 0.6f},
+    {2.6f, 0, 1.425f}, {2.6f, -0.66f, 1.425f}, {3.1f, -0.66f, 0.825f}, {3.1f, 0, 0.825f},
+    {2.3f, 0, 2.1f}, {2.3f, -0.25f, 2.1f}, {2.4f, -0.25f, 2.025f}, {2.4f, 0, 2.025f},
+    {2.7f, 0, 2.4f}, {2.7f, -0.25f, 2.4f}, {3.3f, -0.25f, 2.4f}, {3.3f, 0, 2.4f},
+    {2.8f, 0, 2.475f}, {2.8f, -0.25f, 2.475f}, {3.525f, -0.25f, 2.49375f}, {3.525f, 0, 2.49375f},
+    {2.9f, 0, 2.475f}, {2.9f, -0.15f, 2.475f}, {3.45f, -0.15f, 2.5125f}, {3.45f, 0, 2.5125f},
+    {2.8f, 0, 2.4f}, {2.8f, -0.15f, 2.4f}, {3.2f, -0.15f, 2.4f}, {3.2f, 0, 2.4f},
+    {0, 0, 3.15f}, {0.8f, 0, 3.15f}, {0.8f, -0.45f, 3.15f}, {0.45f, -0.8f, 3.15f},
+    {0, -0.8f, 3.15f}, {0, 0, 2.85f}, {1.4f, 0, 2.4f}, {1.4f, -0.784f, 2.4f},
+    {0.784f, -1.4f, 2.4f}, {0, -1.4f, 2.4f}, {0.4f, 0, 2.55f}, {0.4f, -0.224f, 2.55f},
+    {0.224f, -0.4f, 2.55f}, {0, -0.4f, 2.55f}, {1.3f, 0, 2.55f}, {1.3f, -0.728f, 2.55f},
+    {0.728f, -1.3f, 2.55f}, {0, -1.3f, 2.55f}, {1.3f, 0, 2.4f}, {1.3f, -0.728f, 2.4f},
+    {0.728f, -1.3f, 2.4f}, {0, -1.3f, 2.4f}, {0, 0, 0}, {1.425f, -0.798f, 0},
+    {1.5f, 0, 0.075f}, {1.425f, 0, 0}, {0.798f, -1.425f, 0}, {0, -1.5f, 0.075f},
+    {0, -1.425f, 0}, {1.5f, -0.84f, 0.075f}, {0.84f, -1.5f, 0.075f}
+};
+
+/* cubic bernstein basis and its derivative */
+static void bernstein(float t, float b[4], float d[4]) {
+    float s = 1.0f - t;
+    b[0] = s*s*s; b[1] = 3*t*s*s; b[2] = 3*t*t*s; b[3] = t*t*t;
+    d[0] = -3*s*s; d[1] = 3*s*s - 6*t*s; d[2] = 6*t*s - 3*t*t; d[3] = 3*t*t;
+}
+
+/* position and (unnormalized) normal of a bicubic patch */
+static void evalPatch(VEC3 cp[4][4], float u, float v, VEC3 &p, VEC3 &n) {
+    float bu[4], du[4], bv[4], dv[4];
+    bernstein(u, bu, du);
+    bernstein(v, bv, dv);
+    VEC3 pu = {0, 0, 0}, pv = {0, 0, 0};
+    p = (VEC3){0, 0, 0};
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            p = p + cp[i][j] * (bu[i] * bv[j]);
+            pu = pu + cp[i][j] * (du[i] * bv[j]);
+            pv = pv + cp[i][j] * (bu[i] * dv[j]);
+        }
+    }
+    n = pv ^ pu;
+}
+
+/*!
+    \brief Utah teapot standing on the xz plane, spout towards +x.
+    \param size: scale, 1 gives a teapot about 1 unit high
+    \param tess: quads per patch edge
+*/
+MESH
+Geometry::teapot(float size, unsigned tess) {
+    MeshBuilder b;
+    if (tess == 0) tess = 1;
+    float scale = size / 3.15f;
+    for (int patch = 0; patch < 10; ++patch) {
+        /* mirror images: (flip x, flip y), columns are reversed for a
+           single flip to keep the winding */
+        int copies = patch < 6 ? 4 : 2;
+        for (int c = 0; c < copies; ++c) {
+            bool fx = (c == 2 || c == 3), fy = (c == 1 || c == 3);
+            bool rev = fx != fy;
+            VEC3 cp[4][4];
+            for (int i = 0; i < 4; ++i) {
+                for (int j = 0; j < 4; ++j) {
+                    const float *q = teapotPoint[teapotPatch[patch][i*4 + (rev ? 3-j : j)]];
+                    float x = fx ? -q[0] : q[0], y = fy ? -q[1] : q[1];
+                    /* z-up to y-up */
+                    cp[i][j] = (VEC3){x, q[2], -y} * scale;
+                }
+            }
+            vector<VEC3> pos((tess+1)*(tess+1)), nrm((tess+1)*(tess+1));
+            for (unsigned i = 0; i <= tess; ++i) {
+                for (unsigned j = 0; j <= tess; ++j) {
+                    float u = (float)i / tess, v = (float)j / tess;
+                    VEC3 p, n;
+                    evalPatch(cp, u, v, p, n);
+                    /* collapsed patch edges have no tangent, step inside */
+                    if (n * n < 1e-12f) {
+                        VEC3 tmp;
+                        evalPatch(cp, u + (u < 0.5f ? 1e-3f : -1e-3f),
+                                      v + (v < 0.5f ? 1e-3f : -1e-3f), tmp, n);
+                    }
+                    pos[i*(tess+1)+j] = p;
+                    nrm[i*(tess+1)+j] = n.normalize();
+                }
+            }
+            for (unsigned i = 0; i < tess; ++i) {
+                for (unsigned j = 0; j < tess; ++j) {
+                    unsigned idx[4] = {i*(tess+1)+j, (i+1)*(tess+1)+j,
+                                       (i+1)*(tess+1)+j+1, i*(tess+1)+j+1};
+                    VEC3 p[4], n[4];
+                    VEC2 t[4];
+                    for (int k = 0; k < 4; ++k) {
+                        p[k] = pos[idx[k]];
+                        n[k] = nrm[idx[k]];
+                        t[k] = (VEC2){(float)(idx[k] / (tess+1)) / tess,
+                                      (float)(idx[k] % (tess+1)) / tess};
+                    }
+                    b.quad(p, n, t);
+                }
+            }
+        }
+    }
+    return b.finish();
+}
+
+/*
+    \brief Simulate a FIFO post-transform cache.
+    \returns average cache miss ratio, vertex transforms per triangle
+             (0.5 is ideal for large regular grids, 3 is the worst)
+*/
+float
+Geometry::getACMR(MESH mesh, unsigned cache_size) {
+    vector<unsigned> &idx = *mesh.vertexIndex;
+    if (idx.size() < 3) return 0;
+    vector<unsigned> fifo(cache_size, (unsigned)-1);
+    size_t head = 0, misses = 0;
+    for (size_t i = 0; i < idx.size(); ++i) {
+        if (find(fifo.begin(), fifo.end(), idx[i]) != fifo.end()) continue;
+        fifo[head] = idx[i];
+        head = (head + 1) % cache_size;
+        ++misses;
+    }
+    return (float)misses / (idx.size() / 3);
+}
+
+/*
+    \brief Reorder triangles for the post-transform vertex cache using
+           Forsyth's linear-speed algorithm, then renumber the vertexes in
+           first-use order so that fetches walk memory forwards.
+           Only meshes consisting of triangles are reordered.
+*/
+void
+Geometry::optimizeVertexCache(MESH &mesh, unsigned cache_size) {
+    vector<unsigned> &idx = *mesh.vertexIndex;
+    size_t nf = mesh.faceIndex->size(), nv = mesh.verts->size();
+    if (idx.size() != nf * 3 || nf == 0) return;
+
+    const float kDecay = 1.5f, kLastTri = 0.75f, kValenceScale = 2.0f, kValencePower = 0.5f;
+    unsigned cache_max = cache_size + 3;
+
+    vector<unsigned> live(nv, 0), offset(nv + 1, 0), vtri(idx.size());
+    for (size_t i = 0; i < idx.size(); ++i) ++live[idx[i]];
+    for (size_t v = 0; v < nv; ++v) offset[v+1] = offset[v] + live[v];
+    {
+        vector<unsigned> fill(offset.begin(), offset.end() - 1);
+        for (size_t i = 0; i < idx.size(); ++i) vtri[fill[idx[i]]++] = i / 3;
+    }
+
+    vector<int> cachePos(nv, -1);
+    vector<float> vscore(nv), tscore(nf, 0);
+    vector<bool> added(nf, false);
+
+    auto score = [&](unsigned v) {
+        if (live[v] == 0) return -1.0f;
+        float s = 0;
+        int p = cachePos[v];
+        if (p >= 0) {
+            if (p < 3) s = kLastTri;
+            else s = powf(1.0f - (float)(p - 3) / (cache_max - 3), kDecay);
+        }
+        return s + kValenceScale * powf((float)live[v], -kValencePower);
+    };
+    for (size_t v = 0; v < nv; ++v) vscore[v] = score(v);
+    for (size_t f = 0; f < nf; ++f)
+        tscore[f] = vscore[idx[f*3]] + vscore[idx[f*3+1]] + vscore[idx[f*3+2]];
+
+    vector<unsigned> order;
+    order.reserve(nf);
+    vector<unsigned> cache;
+    size_t scan = 0;
+    int best = -1;
+    while (order.size() < nf) {
+        if (best < 0) {
+            /* nothing useful in cache, take the next unused triangle */
+            while (scan < nf && added[scan]) ++scan;
+            best = scan;
+        }
+        added[best] = true;
+        order.push_back(best);
+
+        /* move the triangle's vertexes to the front of the LRU cache */
+        vector<unsigned> next;
+        for (int k = 0; k < 3; ++k) {
+            unsigned v = idx[best*3+k];
+            next.push_back(v);
+            --live[v];
+            unsigned *t = &vtri[offset[v]];
+            for (unsigned j = 0; j <= live[v]; ++j)
+                if (t[j] == (unsigned)best) { swap(t[j], t[live[v]]); break; }
+        }
+        for (size_t k = 0; k < cache.size(); ++k)
+            if (find(next.begin(), next.end(), cache[k]) == next.end())
+                next.push_back(cache[k]);
+        for (size_t k = cache_max; k < next.size(); ++k) {
+            cachePos[next[k]] = -1;
+            vscore[next[k]] = score(next[k]);
+        }
+        if (next.size() > cache_max) next.resize(cache_max);
+        cache.swap(next);
+
+        /* rescore the cached vertexes and their triangles */
+        for (size_t k = 0; k < cache.size(); ++k) {
+            cachePos[cache[k]] = k;
+            vscore[cache[k]] = score(cache[k]);
+        }
+        best = -1;
+        float bestScore = -1;
+        for (size_t k = 0; k < cache.size(); ++k) {
+            unsigned v = cache[k];
+            for (unsigned j = 0; j < live[v]; ++j) {
+                unsigned f = vtri[offset[v] + j];
+                tscore[f] = vscore[idx[f*3]] + vscore[idx[f*3+1]] + vscore[idx[f*3+2]];
+                if (tscore[f] > bestScore) {
+                    bestScore = tscore[f];
+                    best = f;
+                }
+            }
+        }
+    }
+
+    /* apply the new triangle order to the per-corner attributes */
+    vector<unsigned> newIdx(idx.size());
+    vector<VEC3> newNormal;
+    vector<VEC2> newTexCoord;
+    vector<short> newNormalPacked, newTexCoordPacked;
+    for (size_t i = 0; i < nf; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            size_t c = order[i] * 3 + k;
+            newIdx[i*3+k] = idx[c];
+            if (mesh.normal != nullptr && c < mesh.normal->size()) newNormal.push_back((*mesh.normal)[c]);
+            if (mesh.texCoord != nullptr && c < mesh.texCoord->size()) newTexCoord.push_back((*mesh.texCoord)[c]);
+            /* quantized streams, two shorts per corner */
+            if (mesh.normalPacked != nullptr && c * 2 + 1 < mesh.normalPacked->size()) {
+                newNormalPacked.push_back((*mesh.normalPacked)[c*2]);
+                newNormalPacked.push_back((*mesh.normalPacked)[c*2+1]);
+            }
+            if (mesh.texCoordPacked != nullptr && c * 2 + 1 < mesh.texCoordPacked->size()) {
+                newTexCoordPacked.push_back((*mesh.texCoordPacked)[c*2]);
+                newTexCoordPacked.push_back((*mesh.texCoordPacked)[c*2+1]);
+            }
+        }
+    }
+    if (mesh.normal != nullptr) mesh.normal->swap(newNormal);
+    if (mesh.texCoord != nullptr) mesh.texCoord->swap(newTexCoord);
+    if (mesh.normalPacked != nullptr) mesh.normalPacked->swap(newNormalPacked);
+    if (mesh.texCoordPacked != nullptr) mesh.texCoordPacked->swap(newTexCoordPacked);
+
+    /* vertexes in first-use order */
+    vector<int> remap(nv, -1);
+    vector<VEC3> newVerts;
+    newVerts.reserve(nv);
+    for (size_t i = 0; i < newIdx.size(); ++i) {
+        if (remap[newIdx[i]] < 0) {
+            remap[newIdx[i]] = newVerts.size();
+            newVerts.push_back((*mesh.verts)[newIdx[i]]);
+        }
+        newIdx[i] = remap[newIdx[i]];
+    }
+    idx.swap(newIdx);
+    mesh.verts->swap(newVerts);
+}
+
+}
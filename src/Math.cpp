@@ -22,6 +22,9 @@ SOFTWARE.
 
 #include "pixpix.h"
 #include <cmath>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
 using namespace pixpix;
 
 namespace pixpix {
@@ -69,13 +72,19 @@ Math::rotationZ(float angle) {
     return mat;
 }
 
+/*
+    \brief rotationX(pitch) * rotationY(yaw) * rotationZ(roll), expanded
+*/
 MATRIX4
 Math::pitch_yaw_roll(float pitch, float yaw, float roll) {
-    MATRIX4 rX, rY, rZ, mat;
-    rX = rotationX(pitch);
-    rY = rotationY(yaw);
-    rZ = rotationZ(roll);
-    mat = matrixMul(rX, matrixMul(rY, rZ));
+    MATRIX4 mat;
+    float cp = cos(pitch), sp = sin(pitch);
+    float cy = cos(yaw),   sy = sin(yaw);
+    float cr = cos(roll),  sr = sin(roll);
+    mat.setRow(0, cy*cr,              -cy*sr,              sy,     0.0);
+    mat.setRow(1, cp*sr + sp*sy*cr,   cp*cr - sp*sy*sr,    -sp*cy, 0.0);
+    mat.setRow(2, sp*sr - cp*sy*cr,   sp*cr + cp*sy*sr,    cp*cy,  0.0);
+    mat.setRow(3, 0.0,                0.0,                 0.0,    1.0);
     return mat;
 }
 
@@ -101,8 +110,70 @@ Math::projection(float fovY, float aspect_ratio, float nearZ, float farZ) {
     return mat;
 }
 
+/*
+    \brief Orthographic projection looking down -z, keeps the same depth
+           convention as projection(): clip z is the view distance, w is 1.
+*/
+MATRIX4
+Math::orthographic(float width, float height) {
+    MATRIX4 mat;
+    mat.setRow(0, 2.0f / width, 0.0, 0.0, 0.0);
+    mat.setRow(1, 0.0, 2.0f / height, 0.0, 0.0);
+    mat.setRow(2, 0.0, 0.0, -1.0, 0.0);
+    mat.setRow(3, 0.0, 0.0, 0.0, 1.0);
+    return mat;
+}
+
+/*
+    \brief Inverse of a matrix whose last row is (0, 0, 0, 1), i.e.
+           rotation, scale and translation. The 3x3 part is inverted by
+           cofactors, the translation is -inverse(A) * t.
+*/
+MATRIX4
+Math::affineInverse(const MATRIX4 &m) {
+    const float (*a)[4] = m.mat;
+    float c00 = a[1][1]*a[2][2] - a[1][2]*a[2][1];
+    float c01 = a[1][2]*a[2][0] - a[1][0]*a[2][2];
+    float c02 = a[1][0]*a[2][1] - a[1][1]*a[2][0];
+    float det = a[0][0]*c00 + a[0][1]*c01 + a[0][2]*c02;
+    float id = 1.0f / det;
+    MATRIX4 r;
+    r.mat[0][0] = c00 * id;
+    r.mat[0][1] = (a[0][2]*a[2][1] - a[0][1]*a[2][2]) * id;
+    r.mat[0][2] = (a[0][1]*a[1][2] - a[0][2]*a[1][1]) * id;
+    r.mat[1][0] = c01 * id;
+    r.mat[1][1] = (a[0][0]*a[2][2] - a[0][2]*a[2][0]) * id;
+    r.mat[1][2] = (a[0][2]*a[1][0] - a[0][0]*a[1][2]) * id;
+    r.mat[2][0] = c02 * id;
+    r.mat[2][1] = (a[0][1]*a[2][0] - a[0][0]*a[2][1]) * id;
+    r.mat[2][2] = (a[0][0]*a[1][1] - a[0][1]*a[1][0]) * id;
+    for (int i = 0; i < 3; ++i)
+        r.mat[i][3] = -(r.mat[i][0]*a[0][3] + r.mat[i][1]*a[1][3] + r.mat[i][2]*a[2][3]);
+    r.setRow(3, 0.0, 0.0, 0.0, 1.0);
+    return r;
+}
+
+#ifdef __SSE__
+/* columns of a row major matrix, out = col[0]*x + col[1]*y + col[2]*z + col[3]*w */
+static inline void
+loadColumns(const MATRIX4 &m, __m128 col[4]) {
+    __m128 r0 = _mm_loadu_ps(m.mat[0]), r1 = _mm_loadu_ps(m.mat[1]);
+    __m128 r2 = _mm_loadu_ps(m.mat[2]), r3 = _mm_loadu_ps(m.mat[3]);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    col[0] = r0; col[1] = r1; col[2] = r2; col[3] = r3;
+}
+#endif
+
 VEC4
-Math::matrixVecMul(MATRIX4 mat, VEC4 vec) {
+Math::matrixVecMul(const MATRIX4 &mat, const VEC4 &vec) {
+#ifdef __SSE__
+    __m128 col[4];
+    loadColumns(mat, col);
+    __m128 res = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(col[0], _mm_set1_ps(vec.x)), _mm_mul_ps(col[1], _mm_set1_ps(vec.y))),
+        _mm_add_ps(_mm_mul_ps(col[2], _mm_set1_ps(vec.z)), _mm_mul_ps(col[3], _mm_set1_ps(vec.w))));
+    return VEC4::fromSSE(res);
+#else
     VEC4 res;
     res.x = mat.mat[0][0] * vec.x + mat.mat[0][1] * vec.y + mat.mat[0][2] * vec.z + mat.mat[0][3] * vec.w;
     res.y = mat.mat[1][0] * vec.x + mat.mat[1][1] * vec.y + mat.mat[1][2] * vec.z + mat.mat[1][3] * vec.w;
@@ -110,10 +181,13 @@ Math::matrixVecMul(MATRIX4 mat, VEC4 vec) {
     res.w = mat.mat[3][0] * vec.x + mat.mat[3][1] * vec.y + mat.mat[3][2] * vec.z + mat.mat[3][3] * vec.w;
     // res.regularize();
     return res;
+#endif
 }
 
 MATRIX4
-Math::matrixMul(MATRIX4 mat1, MATRIX4 mat2) {
+Math::matrixMul(const MATRIX4 &mat1, const MATRIX4 &mat2) {
+    /* plain loop, compilers vectorize it at least as well as intrinsics
+       (see test/bench_math.cpp) */
     MATRIX4 mat;
     for (int i = 0; i < 4; ++i) {
         for (int j = 0; j < 4; ++j) {
@@ -126,5 +200,73 @@ Math::matrixMul(MATRIX4 mat1, MATRIX4 mat2) {
     return mat;
 }
 
+/*
+    \brief out[i] = mat * (in[i], 1) for n points
+*/
+void
+Math::transformPoints(const MATRIX4 &mat, const VEC3 *in, VEC4 *out, size_t n) {
+    size_t i = 0;
+#ifdef __SSE__
+    __m128 col[4];
+    loadColumns(mat, col);
+#ifdef __AVX__
+    /* two points per iteration, one in each 128 bit lane */
+    __m256 c0 = _mm256_set_m128(col[0], col[0]), c1 = _mm256_set_m128(col[1], col[1]);
+    __m256 c2 = _mm256_set_m128(col[2], col[2]), c3 = _mm256_set_m128(col[3], col[3]);
+    for (; i + 2 <= n; i += 2) {
+        __m256 x = _mm256_set_m128(_mm_set1_ps(in[i+1].x), _mm_set1_ps(in[i].x));
+        __m256 y = _mm256_set_m128(_mm_set1_ps(in[i+1].y), _mm_set1_ps(in[i].y));
+        __m256 z = _mm256_set_m128(_mm_set1_ps(in[i+1].z), _mm_set1_ps(in[i].z));
+        __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c0, x), _mm256_mul_ps(c1, y)),
+                                 _mm256_add_ps(_mm256_mul_ps(c2, z), c3));
+        _mm256_storeu_ps(&out[i].x, r);
+    }
+#endif
+    for (; i < n; ++i) {
+        __m128 r = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(col[0], _mm_set1_ps(in[i].x)), _mm_mul_ps(col[1], _mm_set1_ps(in[i].y))),
+            _mm_add_ps(_mm_mul_ps(col[2], _mm_set1_ps(in[i].z)), col[3]));
+        _mm_storeu_ps(&out[i].x, r);
+    }
+#else
+    for (; i < n; ++i) out[i] = matrixVecMul(mat, (VEC4){in[i].x, in[i].y, in[i].z, 1.0f});
+#endif
+}
+
+/*
+    \brief Transform n normals by the inverse transpose of the 3x3 part of
+           an affine matrix and renormalize them.
+*/
+void
+Math::transformNormals(const MATRIX4 &mat, const VEC3 *in, VEC3 *out, size_t n) {
+    MATRIX4 inv = affineInverse(mat);
+    /* transpose(inv) * v, i.e. v is combined with the rows of inv */
+    MATRIX4 it;
+    for (int i = 0; i < 4; ++i)
+        for (int j = 0; j < 4; ++j)
+            it.mat[i][j] = i < 3 && j < 3 ? inv.mat[j][i] : 0.0f;
+    size_t i = 0;
+#ifdef __SSE__
+    __m128 col[4];
+    loadColumns(it, col);
+    for (; i < n; ++i) {
+        __m128 r = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(col[0], _mm_set1_ps(in[i].x)), _mm_mul_ps(col[1], _mm_set1_ps(in[i].y))),
+            _mm_mul_ps(col[2], _mm_set1_ps(in[i].z)));
+        __m128 sq = _mm_mul_ps(r, r);
+        __m128 len = _mm_sqrt_ss(_mm_add_ss(_mm_add_ss(sq, _mm_shuffle_ps(sq, sq, 1)), _mm_shuffle_ps(sq, sq, 2)));
+        r = _mm_div_ps(r, _mm_shuffle_ps(len, len, 0));
+        float f[4];
+        _mm_storeu_ps(f, r);
+        out[i] = (VEC3){f[0], f[1], f[2]};
+    }
+#else
+    for (; i < n; ++i) {
+        VEC4 r = matrixVecMul(it, (VEC4){in[i].x, in[i].y, in[i].z, 0.0f});
+        out[i] = ((VEC3){r.x, r.y, r.z}).normalize();
+    }
+#endif
+}
+
 
 }
\ No newline at end of file
@@ -0,0 +1,325 @@
+/*
+Copyright (c) 2018 Zhang Weijia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "pixpix.h"
+#include <cmath>
+#include <queue>
+#include <algorithm>
+using namespace std;
+
+namespace pixpix {
+
+/* symmetric 4x4 quadric, upper triangle only */
+struct QUADRIC {
+    double a[10];
+    QUADRIC() { for (int i = 0; i < 10; ++i) a[i] = 0; }
+    /* plane nx + d = 0 weighted by w */
+    void addPlane(VEC3 n, double d, double w) {
+        a[0] += w*n.x*n.x; a[1] += w*n.x*n.y; a[2] += w*n.x*n.z; a[3] += w*n.x*d;
+                           a[4] += w*n.y*n.y; a[5] += w*n.y*n.z; a[6] += w*n.y*d;
+                                              a[7] += w*n.z*n.z; a[8] += w*n.z*d;
+                                                                 a[9] += w*d*d;
+    }
+    QUADRIC operator + (const QUADRIC &rhs) const {
+        QUADRIC q;
+        for (int i = 0; i < 10; ++i) q.a[i] = a[i] + rhs.a[i];
+        return q;
+    }
+    double error(VEC3 v) const {
+        double x = v.x, y = v.y, z = v.z;
+        return a[0]*x*x + 2*a[1]*x*y + 2*a[2]*x*z + 2*a[3]*x
+                        +   a[4]*y*y + 2*a[5]*y*z + 2*a[6]*y
+                                     +   a[7]*z*z + 2*a[8]*z
+                                                  +   a[9];
+    }
+    /* position minimizing the error, false if the system is singular */
+    bool optimal(VEC3 &v) const {
+        double det = a[0]*(a[4]*a[7]-a[5]*a[5]) - a[1]*(a[1]*a[7]-a[5]*a[2])
+                   + a[2]*(a[1]*a[5]-a[4]*a[2]);
+        if (fabs(det) < 1e-12) return false;
+        double bx = -a[3], by = -a[6], bz = -a[8];
+        v.x = (float)((bx*(a[4]*a[7]-a[5]*a[5]) - a[1]*(by*a[7]-a[5]*bz) + a[2]*(by*a[5]-a[4]*bz)) / det);
+        v.y = (float)((a[0]*(by*a[7]-bz*a[5]) - bx*(a[1]*a[7]-a[5]*a[2]) + a[2]*(a[1]*bz-by*a[2])) / det);
+        v.z = (float)((a[0]*(a[4]*bz-a[5]*by) - a[1]*(a[1]*bz-by*a[2]) + bx*(a[1]*a[5]-a[4]*a[2])) / det);
+        return true;
+    }
+};
+
+/* candidate collapse, stale when either vertex changed since it was pushed */
+struct COLLAPSE {
+    double cost;
+    unsigned a, b;
+    unsigned stampA, stampB;
+    VEC3 target;
+    bool operator < (const COLLAPSE &rhs) const { return cost > rhs.cost; }
+};
+
+static VEC3 faceNormal(VEC3 a, VEC3 b, VEC3 c) {
+    return (b - a) ^ (c - a);
+}
+
+/*!
+    \brief Simplify a triangle mesh by quadric error edge collapse.
+    \param mesh: input mesh, left untouched
+    \param target_faces: stop once no more than this many triangles remain
+    \returns a newly allocated mesh
+*/
+MESH
+MeshSimplifier::simplify(MESH mesh, unsigned target_faces) {
+    vector<VEC3> pos(*mesh.verts);
+    size_t nv = pos.size();
+
+    /* triangles, corners keep the index of their attributes in the input */
+    vector<unsigned> tri, corner;
+    size_t p = 0;
+    for (size_t i = 0; i < mesh.faceIndex->size(); ++i) {
+        unsigned cnt = (*mesh.faceIndex)[i];
+        if (cnt == 3) {
+            for (unsigned j = 0; j < 3; ++j) {
+                tri.push_back((*mesh.vertexIndex)[p+j]);
+                corner.push_back(p+j);
+            }
+        }
+        p += cnt;
+    }
+    size_t nf = tri.size() / 3;
+
+    vector<bool> faceAlive(nf, true);
+    vector<vector<unsigned> > vertFaces(nv);
+    vector<QUADRIC> quad(nv);
+    for (size_t f = 0; f < nf; ++f) {
+        VEC3 n = faceNormal(pos[tri[f*3]], pos[tri[f*3+1]], pos[tri[f*3+2]]);
+        float area = sqrt(n * n);
+        if (area > 0) n = n / area;
+        double d = -(n * pos[tri[f*3]]);
+        for (unsigned j = 0; j < 3; ++j) {
+            quad[tri[f*3+j]].addPlane(n, d, area);
+            vertFaces[tri[f*3+j]].push_back(f);
+        }
+    }
+
+    /* border edges get a perpendicular plane so that open meshes keep
+       their outline */
+    {
+        vector<pair<unsigned, unsigned> > edges;
+        for (size_t f = 0; f < nf; ++f)
+            for (unsigned j = 0; j < 3; ++j) {
+                unsigned u = tri[f*3+j], v = tri[f*3+(j+1)%3];
+                edges.push_back(make_pair(min(u, v), max(u, v)));
+            }
+        vector<pair<unsigned, unsigned> > sorted(edges);
+        sort(sorted.begin(), sorted.end());
+        for (size_t f = 0; f < nf; ++f) {
+            VEC3 n = faceNormal(pos[tri[f*3]], pos[tri[f*3+1]], pos[tri[f*3+2]]);
+            for (unsigned j = 0; j < 3; ++j) {
+                pair<unsigned, unsigned> e = edges[f*3+j];
+                pair<vector<pair<unsigned, unsigned> >::iterator,
+                     vector<pair<unsigned, unsigned> >::iterator> range =
+                    equal_range(sorted.begin(), sorted.end(), e);
+                if (range.second - range.first != 1) continue;
+                VEC3 dir = pos[e.second] - pos[e.first];
+                VEC3 bn = dir ^ n;
+                float len = sqrt(bn * bn);
+                if (len <= 0) continue;
+                bn = bn / len;
+                double w = (dir * dir) * 1000.0;
+                quad[e.first].addPlane(bn, -(bn * pos[e.first]), w);
+                quad[e.second].addPlane(bn, -(bn * pos[e.first]), w);
+            }
+        }
+    }
+
+    vector<unsigned> stamp(nv, 0);
+    vector<bool> vertAlive(nv, true);
+    priority_queue<COLLAPSE> heap;
+
+    /* evaluate and push a candidate */
+    auto pushEdge = [&](unsigned a, unsigned b) {
+        QUADRIC q = quad[a] + quad[b];
+        COLLAPSE c;
+        c.a = a; c.b = b;
+        c.stampA = stamp[a]; c.stampB = stamp[b];
+        if (!q.optimal(c.target)) {
+            VEC3 mid = (pos[a] + pos[b]) / 2.0f;
+            c.target = pos[a];
+            if (q.error(pos[b]) < q.error(c.target)) c.target = pos[b];
+            if (q.error(mid) < q.error(c.target)) c.target = mid;
+        }
+        c.cost = q.error(c.target);
+        heap.push(c);
+    };
+
+    for (size_t f = 0; f < nf; ++f)
+        for (unsigned j = 0; j < 3; ++j) {
+            /* border edges are only seen in one direction, keep both */
+            pushEdge(tri[f*3+j], tri[f*3+(j+1)%3]);
+        }
+
+    /* true if moving the faces around `v` to `target` flips any of them */
+    auto flips = [&](unsigned v, unsigned other, VEC3 target) {
+        for (size_t k = 0; k < vertFaces[v].size(); ++k) {
+            unsigned f = vertFaces[v][k];
+            if (!faceAlive[f]) continue;
+            unsigned *t = &tri[f*3];
+            if (t[0] == other || t[1] == other || t[2] == other) continue;
+            VEC3 p0 = pos[t[0]], p1 = pos[t[1]], p2 = pos[t[2]];
+            VEC3 before = faceNormal(p0, p1, p2);
+            if (t[0] == v) p0 = target;
+            if (t[1] == v) p1 = target;
+            if (t[2] == v) p2 = target;
+            if (before * faceNormal(p0, p1, p2) <= 0) return true;
+        }
+        return false;
+    };
+
+    size_t liveFaces = nf;
+    while (liveFaces > target_faces && !heap.empty()) {
+        COLLAPSE c = heap.top();
+        heap.pop();
+        if (!vertAlive[c.a] || !vertAlive[c.b]) continue;
+        if (stamp[c.a] != c.stampA || stamp[c.b] != c.stampB) continue;
+        if (flips(c.a, c.b, c.target) || flips(c.b, c.a, c.target)) continue;
+
+        /* collapse b into a */
+        unsigned a = c.a, b = c.b;
+        pos[a] = c.target;
+        quad[a] = quad[a] + quad[b];
+        vertAlive[b] = false;
+        for (size_t k = 0; k < vertFaces[b].size(); ++k) {
+            unsigned f = vertFaces[b][k];
+            if (!faceAlive[f]) continue;
+            unsigned *t = &tri[f*3];
+            for (unsigned j = 0; j < 3; ++j)
+                if (t[j] == b) t[j] = a;
+            if (t[0] == t[1] || t[1] == t[2] || t[0] == t[2]) {
+                faceAlive[f] = false;
+                --liveFaces;
+            } else {
+                vertFaces[a].push_back(f);
+            }
+        }
+        vertFaces[b].clear();
+
+        /* drop dead faces and requeue the edges around a */
+        vector<unsigned> &faces = vertFaces[a];
+        size_t w = 0;
+        for (size_t k = 0; k < faces.size(); ++k)
+            if (faceAlive[faces[k]]) faces[w++] = faces[k];
+        faces.resize(w);
+        ++stamp[a];
+        vector<unsigned> ring;
+        for (size_t k = 0; k < faces.size(); ++k)
+            for (unsigned j = 0; j < 3; ++j) {
+                unsigned u = tri[faces[k]*3+j];
+                if (u != a) ring.push_back(u);
+            }
+        sort(ring.begin(), ring.end());
+        ring.erase(unique(ring.begin(), ring.end()), ring.end());
+        for (size_t k = 0; k < ring.size(); ++k)
+            pushEdge(a, ring[k]);
+    }
+
+    /* compact the output */
+    MESH out;
+    out.verts = new vector<VEC3>;
+    out.faceIndex = new vector<unsigned>;
+    out.vertexIndex = new vector<unsigned>;
+    /* attributes stay in the form the input has them, float or packed */
+    if (mesh.normal != nullptr) out.normal = new vector<VEC3>;
+    if (mesh.texCoord != nullptr) out.texCoord = new vector<VEC2>;
+    if (mesh.normalPacked != nullptr) out.normalPacked = new vector<short>;
+    if (mesh.texCoordPacked != nullptr) out.texCoordPacked = new vector<short>;
+    vector<int> remap(nv, -1);
+    for (size_t f = 0; f < nf; ++f) {
+        if (!faceAlive[f]) continue;
+        out.faceIndex->push_back(3);
+        for (unsigned j = 0; j < 3; ++j) {
+            unsigned v = tri[f*3+j];
+            if (remap[v] < 0) {
+                remap[v] = out.verts->size();
+                out.verts->push_back(pos[v]);
+            }
+            out.vertexIndex->push_back(remap[v]);
+            unsigned c = corner[f*3+j];
+            if (out.normal != nullptr) out.normal->push_back((*mesh.normal)[c]);
+            if (out.texCoord != nullptr) out.texCoord->push_back((*mesh.texCoord)[c]);
+            if (out.normalPacked != nullptr) {
+                out.normalPacked->push_back((*mesh.normalPacked)[c*2]);
+                out.normalPacked->push_back((*mesh.normalPacked)[c*2+1]);
+            }
+            if (out.texCoordPacked != nullptr) {
+                out.texCoordPacked->push_back((*mesh.texCoordPacked)[c*2]);
+                out.texCoordPacked->push_back((*mesh.texCoordPacked)[c*2+1]);
+            }
+        }
+    }
+    return out;
+}
+
+/*!
+    \brief Build a LOD chain by repeated simplification.
+    \param mesh: full detail mesh, stored as level 0 (not copied)
+    \param max_levels: upper bound of levels including level 0
+    \param min_faces: stop once a level has fewer triangles than this
+    \param ratio: triangle ratio between two consecutive levels
+*/
+MESH_LOD
+MeshSimplifier::buildLOD(MESH mesh, unsigned max_levels, unsigned min_faces, float ratio) {
+    MESH_LOD lod;
+    lod.levels.push_back(mesh);
+    lod.faceCount.push_back(mesh.faceIndex->size());
+
+    /* bounding sphere from the bounding box */
+    vector<VEC3> &v = *mesh.verts;
+    if (!v.empty()) {
+        VEC3 lo = v[0], hi = v[0];
+        for (size_t i = 1; i < v.size(); ++i) {
+            lo.x = min(lo.x, v[i].x); lo.y = min(lo.y, v[i].y); lo.z = min(lo.z, v[i].z);
+            hi.x = max(hi.x, v[i].x); hi.y = max(hi.y, v[i].y); hi.z = max(hi.z, v[i].z);
+        }
+        lod.center = (lo + hi) / 2.0f;
+        for (size_t i = 0; i < v.size(); ++i) {
+            VEC3 d = v[i] - lod.center;
+            lod.radius = max(lod.radius, (float)sqrt(d * d));
+        }
+    }
+
+    while (lod.levels.size() < max_levels) {
+        unsigned prev = lod.faceCount.back();
+        unsigned target = (unsigned)(prev * ratio);
+        if (target < min_faces) break;
+        MESH next = simplify(lod.levels.back(), target);
+        unsigned cnt = next.faceIndex->size();
+        /* the simplifier got stuck, further levels would not help */
+        if (cnt >= prev * (1.0f + ratio) / 2.0f) {
+            delete next.verts; delete next.faceIndex; delete next.vertexIndex;
+            delete next.normal; delete next.texCoord;
+            delete next.normalPacked; delete next.texCoordPacked;
+            break;
+        }
+        lod.levels.push_back(next);
+        lod.faceCount.push_back(cnt);
+    }
+    return lod;
+}
+
+}
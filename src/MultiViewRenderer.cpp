@@ -0,0 +1,178 @@
+/*
+Copyright (c) 2018 Zhang Weijia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "pixpix.h"
+#include <cmath>
+#include <atomic>
+#include <thread>
+#include <chrono>
+using namespace std;
+
+namespace pixpix {
+
+MultiViewRenderer::MultiViewRenderer(unsigned thread_count):
+    threads(thread_count), shadowMapSize(0), shadowPCF(1), shadowBias(0.05f) {
+    if (threads == 0) threads = thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+}
+
+MultiViewRenderer::~MultiViewRenderer() {
+    for (size_t i = 0; i < pipes.size(); ++i) delete pipes[i];
+}
+
+/*
+    \brief Same as RenderPipeline3D::setShadow, applied to every view.
+*/
+void
+MultiViewRenderer::setShadow(unsigned map_size, unsigned pcf_radius, float bias) {
+    shadowMapSize = map_size;
+    shadowPCF = pcf_radius;
+    shadowBias = bias;
+}
+
+/*
+    \brief Conservative test of a bounding sphere against the view frustum
+           of `cam`, `view` being its world -> camera space matrix.
+*/
+bool
+MultiViewRenderer::isVisible(BOUNDS b, const MATRIX4 &view, const CAMERA &cam) {
+    VEC4 c = Math::matrixVecMul(view, (VEC4){b.center.x, b.center.y, b.center.z, 1.0f});
+    float d = -c.z;                             /* distance along the view */
+    if (d + b.radius < cam.nearZ || d - b.radius > cam.farZ) return false;
+    float ty = tanf(cam.fovY / 2.0f), tx = ty * cam.aspect_ratio;
+    /* distance to the side planes |x| = d * tx and |y| = d * ty */
+    if (fabs(c.x) - d * tx > b.radius * sqrtf(1.0f + tx * tx)) return false;
+    if (fabs(c.y) - d * ty > b.radius * sqrtf(1.0f + ty * ty)) return false;
+    return true;
+}
+
+/*
+    \brief Rasterize the scene into one view with the pipeline of the
+           calling worker, shading with the shared `shadow_maps`.
+*/
+void
+MultiViewRenderer::renderView(RenderPipeline3D *pipe, VIEW view, const SCENE &scene, vector<SHADOW_MAP> *shadow_maps,
+                              const vector<MESH> &meshes, const vector<BOUNDS> &bounds) {
+    pipe->setCanvas(view.canvas);
+    pipe->setCamera(view.camera);
+    pipe->init();
+    pipe->setShadow(shadowMapSize, shadowPCF, shadowBias);
+    for (size_t i = 0; i < scene.lights.size(); ++i)
+        pipe->addLight(scene.lights[i]);
+    pipe->shareShadowMaps(shadow_maps);
+
+    MATRIX4 m_view = pipe->getViewMatrix(view.camera->position, view.camera->rotation);
+    for (size_t i = 0; i < scene.draws.size(); ++i) {
+        if (!isVisible(bounds[i], m_view, *view.camera)) continue;
+        pipe->setTexture(scene.draws[i].texture);
+        pipe->setMaterial(scene.draws[i].material);
+        pipe->render(meshes[i]);
+    }
+    pipe->flush();
+}
+
+/*
+    \brief Render `scene` into every view, each view gets a full frame as
+           if rendered alone by a RenderPipeline3D in immediate mode.
+    \returns timing of the whole call
+*/
+MULTI_VIEW_STATS
+MultiViewRenderer::render(const SCENE &scene, const vector<VIEW> &views) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    MULTI_VIEW_STATS stats = {(unsigned)views.size(), 0, 0.0, 0.0};
+    if (views.empty()) return stats;
+
+    unsigned n_threads = min(threads, (unsigned)views.size());
+    while (pipes.size() < n_threads)
+        pipes.push_back(new RenderPipeline3D(views[0].canvas, views[0].camera));
+
+    /* shadow maps do not depend on the viewer, render them once in the
+       first pipeline; its cache also keeps them across calls */
+    RenderPipeline3D *first = pipes[0];
+    first->setCanvas(views[0].canvas);
+    first->setCamera(views[0].camera);
+    first->init();
+    first->setShadow(shadowMapSize, shadowPCF, shadowBias);
+    for (size_t i = 0; i < scene.lights.size(); ++i)
+        first->addLight(scene.lights[i]);
+    for (size_t i = 0; i < scene.casters.size(); ++i)
+        first->addShadowCaster(scene.casters[i]);
+    /* read before the workers start, pipes[0] is one of them */
+    vector<SHADOW_MAP> *shadow_maps = first->prepareShadowMaps();
+
+    /* unpack quantized attributes once instead of once per view, and
+       bound every mesh for the per view culling */
+    vector<MESH> meshes(scene.draws.size());
+    vector<BOUNDS> bounds(scene.draws.size());
+    for (size_t i = 0; i < scene.draws.size(); ++i) {
+        MESH m = scene.draws[i].mesh;
+        if (m.normal == nullptr) {
+            size_t n = m.vertexIndex->size();
+            m.normal = new vector<VEC3>(n);
+            m.texCoord = new vector<VEC2>(n);
+            Packing::unpackNormals(m.normalPacked->data(), m.normal->data(), n);
+            Packing::unpackTexCoords(m.texCoordPacked->data(), m.texCoord->data(), n);
+        }
+        meshes[i] = m;
+
+        vector<VEC3> &v = *m.verts;
+        VEC3 lo = {INFINITY, INFINITY, INFINITY}, hi = {-INFINITY, -INFINITY, -INFINITY};
+        for (size_t j = 0; j < v.size(); ++j) {
+            lo = (VEC3){min(lo.x, v[j].x), min(lo.y, v[j].y), min(lo.z, v[j].z)};
+            hi = (VEC3){max(hi.x, v[j].x), max(hi.y, v[j].y), max(hi.z, v[j].z)};
+        }
+        BOUNDS &b = bounds[i];
+        b.center = v.empty() ? (VEC3){0, 0, 0} : (lo + hi) * 0.5f;
+        float r2 = 0;
+        for (size_t j = 0; j < v.size(); ++j)
+            r2 = max(r2, (v[j] - b.center) * (v[j] - b.center));
+        b.radius = sqrtf(r2);
+    }
+
+    /* views are taken from a shared counter, so a slow view does not
+       hold back a whole slice */
+    atomic<unsigned> next(0);
+    vector<thread> workers;
+    for (unsigned t = 0; t < n_threads; ++t) {
+        workers.push_back(thread([&, t]() {
+            for (unsigned v; (v = next++) < views.size(); )
+                renderView(pipes[t], views[v], scene, shadow_maps, meshes, bounds);
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); ++t) workers[t].join();
+
+    for (size_t i = 0; i < scene.draws.size(); ++i) {
+        if (scene.draws[i].mesh.normal != nullptr) continue;
+        delete meshes[i].normal;
+        delete meshes[i].texCoord;
+    }
+
+    stats.threads = n_threads;
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    /* threads beyond the core count do not add throughput */
+    unsigned cores = thread::hardware_concurrency();
+    if (cores == 0 || cores > n_threads) cores = n_threads;
+    stats.viewsPerSecondPerCore = stats.seconds > 0 ? views.size() / stats.seconds / cores : 0;
+    return stats;
+}
+
+}
\ No newline at end of file
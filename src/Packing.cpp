@@ -0,0 +1,184 @@
+/*
+Copyright (c) 2018 Zhang Weijia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "pixpix.h"
+#include <cmath>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+using namespace std;
+
+namespace pixpix {
+
+#define CLAMP(x, lo, hi) ((x)<(lo)?(lo):((x)>(hi)?(hi):(x)))
+
+static const float TEX_SCALE = 4096.0f;     /* 4.12 fixed point */
+static const float NORMAL_SCALE = 32767.0f; /* snorm16          */
+
+unsigned
+Packing::packColor(COLOR4 c) {
+    unsigned r = (unsigned)(CLAMP(c.x, 0.0f, 1.0f) * 255.0f + 0.5f);
+    unsigned g = (unsigned)(CLAMP(c.y, 0.0f, 1.0f) * 255.0f + 0.5f);
+    unsigned b = (unsigned)(CLAMP(c.z, 0.0f, 1.0f) * 255.0f + 0.5f);
+    unsigned a = (unsigned)(CLAMP(c.w, 0.0f, 1.0f) * 255.0f + 0.5f);
+    return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+COLOR4
+Packing::unpackColor(unsigned c) {
+    const float k = 1.0f / 255.0f;
+    return (COLOR4){(c & 0xff) * k, ((c >> 8) & 0xff) * k,
+                    ((c >> 16) & 0xff) * k, (c >> 24) * k};
+}
+
+/* texture coordinates in [-8, 8) with a 1/4096 step */
+void
+Packing::packTexCoord(VEC2 t, short out[2]) {
+    out[0] = (short)lroundf(CLAMP(t.x * TEX_SCALE, -32768.0f, 32767.0f));
+    out[1] = (short)lroundf(CLAMP(t.y * TEX_SCALE, -32768.0f, 32767.0f));
+}
+
+VEC2
+Packing::unpackTexCoord(const short in[2]) {
+    return (VEC2){in[0] / TEX_SCALE, in[1] / TEX_SCALE};
+}
+
+/*
+    \brief Octahedral normal encoding: project onto the octahedron
+           |x|+|y|+|z| = 1 and fold the lower half over the diagonals.
+*/
+void
+Packing::packNormal(VEC3 n, short out[2]) {
+    float l1 = fabs(n.x) + fabs(n.y) + fabs(n.z);
+    if (l1 <= 0) { out[0] = out[1] = 0; return; }
+    float x = n.x / l1, y = n.y / l1;
+    if (n.z < 0) {
+        float fx = (1.0f - fabs(y)) * (x >= 0 ? 1.0f : -1.0f);
+        float fy = (1.0f - fabs(x)) * (y >= 0 ? 1.0f : -1.0f);
+        x = fx; y = fy;
+    }
+    out[0] = (short)lroundf(CLAMP(x, -1.0f, 1.0f) * NORMAL_SCALE);
+    out[1] = (short)lroundf(CLAMP(y, -1.0f, 1.0f) * NORMAL_SCALE);
+}
+
+VEC3
+Packing::unpackNormal(const short in[2]) {
+    float x = in[0] * (1.0f / NORMAL_SCALE), y = in[1] * (1.0f / NORMAL_SCALE);
+    float z = 1.0f - fabs(x) - fabs(y);
+    float t = z < 0 ? -z : 0;
+    x += x >= 0 ? -t : t;
+    y += y >= 0 ? -t : t;
+    float len = sqrt(x*x + y*y + z*z);
+    return (VEC3){x / len, y / len, z / len};
+}
+
+#ifdef __SSE2__
+/* four octahedral normals, x and y already scaled to [-1, 1] */
+static inline void
+decodeNormals4(__m128 x, __m128 y, VEC3 *out) {
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 ax = _mm_andnot_ps(sign, x), ay = _mm_andnot_ps(sign, y);
+    __m128 z = _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(1.0f), ax), ay);
+    __m128 t = _mm_max_ps(_mm_sub_ps(_mm_setzero_ps(), z), _mm_setzero_ps());
+    /* x -= sign(x) * t */
+    x = _mm_sub_ps(x, _mm_or_ps(t, _mm_and_ps(x, sign)));
+    y = _mm_sub_ps(y, _mm_or_ps(t, _mm_and_ps(y, sign)));
+    __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+    x = _mm_div_ps(x, len); y = _mm_div_ps(y, len); z = _mm_div_ps(z, len);
+    float fx[4], fy[4], fz[4];
+    _mm_storeu_ps(fx, x); _mm_storeu_ps(fy, y); _mm_storeu_ps(fz, z);
+    for (int i = 0; i < 4; ++i) out[i] = (VEC3){fx[i], fy[i], fz[i]};
+}
+
+/* sign extend the 16 bit lanes of `v` into two float vectors */
+static inline void
+shortsToFloats(__m128i v, __m128 &lo, __m128 &hi) {
+    lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+    hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+}
+#endif
+
+/*
+    \brief Batch decode of `n` interleaved (x, y) octahedral normals.
+*/
+void
+Packing::unpackNormals(const short *in, VEC3 *out, size_t n) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128 scale = _mm_set1_ps(1.0f / NORMAL_SCALE);
+    for (; i + 4 <= n; i += 4) {
+        __m128 a, b;
+        shortsToFloats(_mm_loadu_si128((const __m128i *)(in + i * 2)), a, b);
+        /* a = x0 y0 x1 y1, b = x2 y2 x3 y3 */
+        __m128 x = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 y = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        decodeNormals4(_mm_mul_ps(x, scale), _mm_mul_ps(y, scale), out + i);
+    }
+#endif
+    for (; i < n; ++i) out[i] = unpackNormal(in + i * 2);
+}
+
+/*
+    \brief Batch decode of `n` interleaved (u, v) texture coordinates.
+*/
+void
+Packing::unpackTexCoords(const short *in, VEC2 *out, size_t n) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128 scale = _mm_set1_ps(1.0f / TEX_SCALE);
+    for (; i + 4 <= n; i += 4) {
+        __m128 a, b;
+        shortsToFloats(_mm_loadu_si128((const __m128i *)(in + i * 2)), a, b);
+        _mm_storeu_ps(&out[i].x, _mm_mul_ps(a, scale));
+        _mm_storeu_ps(&out[i + 2].x, _mm_mul_ps(b, scale));
+    }
+#endif
+    for (; i < n; ++i) out[i] = unpackTexCoord(in + i * 2);
+}
+
+/*
+    \brief Quantize the normals and texture coordinates of a mesh, 8
+           instead of 20 bytes per corner.
+    \returns a mesh sharing the vertexes and indexes of `mesh` with new
+              packed streams and no float ones. `mesh` and its copies are
+              left untouched; whoever owns its float streams may free them
+              once no copy uses them.
+*/
+MESH
+Packing::packMesh(MESH mesh) {
+    if (mesh.normal == nullptr) return mesh;
+    size_t n = mesh.normal->size();
+    MESH packed = mesh;
+    packed.normalPacked = new vector<short>(n * 2);
+    packed.texCoordPacked = new vector<short>(n * 2);
+    for (size_t i = 0; i < n; ++i) {
+        packNormal((*mesh.normal)[i], &(*packed.normalPacked)[i * 2]);
+        packTexCoord((*mesh.texCoord)[i], &(*packed.texCoordPacked)[i * 2]);
+    }
+    packed.normal = nullptr;
+    packed.texCoord = nullptr;
+    return packed;
+}
+
+#undef CLAMP
+
+}
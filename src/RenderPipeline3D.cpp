@@ -24,10 +24,23 @@ SOFTWARE.
 #include <cmath>
 #include <cstdio>
 #include <algorithm>
+#include <chrono>
+#include <cstring>
 using namespace std;
 
 namespace pixpix {
 
+/* FNV-1a, tells whether the inputs of cached data changed */
+static unsigned long long
+hashBytes(const void *data, size_t len, unsigned long long h = 14695981039346656037ULL) {
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
 /*
     \brief calculate s, t so that s*b+t*c+(1-s-t)*a = p
 */
@@ -51,28 +64,29 @@ RenderPipeline3D::getChessBoard(VEC2 tex_coord, unsigned sz, COLOR4 color1, COLO
 
 bool
 RenderPipeline3D::zBufferTest(RASTERIZED_FRAGMENT frag, float depth) {
-    for (int i = fragment->size()-1; i >= 0; --i) {
-        if (frag.posX != (*fragment)[i].posX || frag.posY != (*fragment)[i].posY)
-            continue;
-        if (depth > (*zBuffer)[i])
-            return false;
-        return true;
-    }
-    return true;
+    return depth <= (*zBuffer)[frag.posX + frag.posY * canvas->w];
 }
 
 void
 RenderPipeline3D::shadeFragment(RASTERIZED_FRAGMENT &frag, VEC3 pos_origin) {
-    if (texture == nullptr) return;
+    /* opaque white unless a texture says otherwise, storeFragment picks
+       the blended path by alpha */
+    frag.color = (COLOR4){1.0f, 1.0f, 1.0f, 1.0f};
+    if (texture == nullptr) {
+        if (material != nullptr) frag.color.w = material->opacity;
+        return;
+    }
     /* diffuse color */
     if (texture->ty == T_CHESS_BOARD) {
         frag.color = getChessBoard(frag.tex_coord, texture->sz, texture->color1, texture->color2);
+    } else if (texture->ty == T_COLOR) {
+        frag.color = texture->color;
     }
     COLOR4 diffuseColor = frag.color;
     if (frag.normal * (camera->position - pos_origin).normalize() <= 0) frag.normal = (VEC3){0, 0, 0} - frag.normal;
     /* 环境反射 漫反射 高光 */
     if (material != nullptr) {
-        frag.color = {0, 0, 0, 1.0f};
+        frag.color = {0, 0, 0, diffuseColor.w * material->opacity};
         for (int i = 0; i < light->size(); ++i) {
             LIGHT cur_light = (*light)[i];
             if (!cur_light.mIsEnabled) continue;
@@ -82,17 +96,24 @@ RenderPipeline3D::shadeFragment(RASTERIZED_FRAGMENT &frag, VEC3 pos_origin) {
                          diffuseColor.z * cur_light.mAmbientColor.z,
                          0.0};
 
-            float diffuse = (cur_light.mPosition - pos_origin).normalize() * frag.normal * cur_light.mDiffuseIntensity;
+            VEC3 light_dir = cur_light.mType == L_DIRECTIONAL ?
+                (VEC3){0, 0, 0} - cur_light.mDirection.normalize() :
+                (cur_light.mPosition - pos_origin).normalize();
+            float diffuse = light_dir * frag.normal * cur_light.mDiffuseIntensity;
             if (diffuse < 0) continue;
             /* reflection vector =
                (->)n + (->)n - (->)v
             */
-            VEC3 v = (cur_light.mPosition - pos_origin).normalize();
+            VEC3 v = light_dir;
             v = v / (v * frag.normal);
             float specular = pow((frag.normal * 2.0f - v).normalize()
             *(camera->position - pos_origin).normalize(),material->specularSmoothLevel) * cur_light.mSpecularIntensity;
             diffuse = diffuse > 0? diffuse : 0;
             specular = specular > 0? specular : 0;
+            /* occlusion */
+            float visibility = shadowFactor(i, pos_origin);
+            diffuse *= visibility;
+            specular *= visibility;
 
             COLOR3 c1;
             /* diffuse color */
@@ -128,57 +149,24 @@ RenderPipeline3D::renderTriangle(
     vector<VEC3> *normal, vector<VEC2> *tex_coord,
     vector<unsigned> *tri_verts
 ) {
-    /* clip triangle 
-       In this implementation, i just throw the out-of-range triangles out.
-       Also, the face which winds clock-wisely should be thrown out.
-    */
-    bool is_clipped = true;
     VEC3 v_origin[3];
     VEC4 v_homo[3];
     VEC3 v_normal[3];
     VEC2 v_tex_coord[3];
     VEC2 v2d[3];
     for (size_t i = 0; i < 3; ++i) {
-        unsigned v_idx = (*tri_verts)[i];
-        VEC4 v_h = (*verts_homo)[v_idx];
+        VEC4 v_h = (*verts_homo)[(*tri_verts)[i]];
         v_homo[i] = v_h;
-        v_origin[i] = (*verts)[v_idx];
-        v_tex_coord[i] = (*tex_coord)[i];
-        v_normal[i] = (*normal)[i];
-        
-        float x = v_h.getx(), y = v_h.gety(), z = v_h.z;
-        v2d[i] = (VEC2){x, y};
-        if (x >= -1 && x <= 1 && y >= -1 && y <= 1 && z >= camera->nearZ && z <= camera->farZ) {
-            is_clipped = false;
-        }
+        v2d[i] = (VEC2){v_h.getx(), v_h.gety()};
     }
-    if (is_clipped) return;
-    /* winding */
+    /* winding, the cheapest test goes first as it rejects half of a
+       closed mesh */
     if (((v2d[1]-v2d[0])^(v2d[2]-v2d[0])) < 0) return;
-    
-    /* fill triangle */
-    /* triangle bound */
-#define MIN(a,b) ((a)>(b)?(b):(a))
-#define MAX(a,b) ((a)>(b)?(a):(b))
-    float minX=1, minY=1, maxX=-1, maxY=-1;
-    for (size_t i = 0; i < 3; ++i) {
-        minX = MIN(minX, v2d[i].x);
-        minY = MIN(minY, v2d[i].y);
-        maxX = MAX(maxX, v2d[i].x);
-        maxY = MAX(maxY, v2d[i].y);
-    }
-    /*
-     ^ y         O---> x
-     |       ->  |        SCREEN COORDINATE
-     O---> x     v y
-    */
-    minX = (float)(MAX(-1,minX)+1)/2*canvas->w;
-    minY = (float)(-MAX(-1,minY)+1)/2*canvas->h;
-    maxX = (float)(MIN(1,maxX)+1)/2*canvas->w;
-    maxY = (float)(-MIN(1,maxY)+1)/2*canvas->h;
-    swap(minY, maxY);
-#undef MIN
-#undef MAX
+    SCREEN_RECT rect;
+    if (!getTriangleRect(v_homo, rect)) return;
+    /* only the part inside the scissor is filled */
+    rect = rect.intersect(scissor);
+    if (rect.empty()) return;
     
     /* screen coordinate */
 #define TO_SCREEN(v) (VEC2){(float)(v.x+1)/2*canvas->w, (float)(-v.y+1)/2*canvas->h}
@@ -186,8 +174,23 @@ RenderPipeline3D::renderTriangle(
         v2d[i] = TO_SCREEN(v2d[i]);
     }
 #undef TO_SCREEN
-    for (unsigned x = minX; x <= maxX; ++x) {
-        for (unsigned y = minY; y <= maxY; ++y) {
+    /* pixel samples sit on integer coordinates: shrink the rectangle to
+       the samples inside the bounds, a triangle without any, or without
+       area, covers nothing */
+    float min_x = min(v2d[0].x, min(v2d[1].x, v2d[2].x)), max_x = max(v2d[0].x, max(v2d[1].x, v2d[2].x));
+    float min_y = min(v2d[0].y, min(v2d[1].y, v2d[2].y)), max_y = max(v2d[0].y, max(v2d[1].y, v2d[2].y));
+    rect = rect.intersect((SCREEN_RECT){(int)ceilf(min_x), (int)ceilf(min_y), (int)floorf(max_x), (int)floorf(max_y)});
+    if (rect.empty() || ((v2d[1]-v2d[0])^(v2d[2]-v2d[0])) == 0) return;
+
+    /* the attributes are only fetched for triangles that cover pixels */
+    for (size_t i = 0; i < 3; ++i) {
+        v_origin[i] = (*verts)[(*tri_verts)[i]];
+        v_tex_coord[i] = (*tex_coord)[i];
+        v_normal[i] = (*normal)[i];
+    }
+
+    for (unsigned x = rect.x0; x <= (unsigned)rect.x1; ++x) {
+        for (unsigned y = rect.y0; y <= (unsigned)rect.y1; ++y) {
             VEC2 pos = (VEC2){(float)x, (float)y};
             /* judge if (x y) is in triangle */
 #define BETWEEN(a, b, c, d) (((b-a)^(d-a))*((d-a)^(c-a))>=-1e-6)
@@ -210,14 +213,99 @@ RenderPipeline3D::renderTriangle(
             cur_frag.normal = (v_normal[0]*(1-s-t)/v_homo[0].z + v_normal[1]*s/v_homo[1].z + v_normal[2]*t/v_homo[2].z) * depth;
             cur_frag.tex_coord = (v_tex_coord[0]*(1-s-t)/v_homo[0].z + v_tex_coord[1]*s/v_homo[1].z + v_tex_coord[2]*t/v_homo[2].z) * depth;
             cur_frag_origin = (v_origin[0]*(1-s-t)/v_homo[0].z + v_origin[1]*s/v_homo[1].z + v_origin[2]*t/v_homo[2].z) * depth;
-            shadeFragment(cur_frag, cur_frag_origin);
-            fragment->push_back(cur_frag);
-            zBuffer->push_back(depth);
-            canvas->setPixel(cur_frag.posX, cur_frag.posY, cur_frag.color);
+            storeFragment(cur_frag, cur_frag_origin, depth);
         }
     }
 }
 
+/*
+    \brief Shade a fragment that passed the z test and write it. The
+           z-buffer only holds opaque surfaces, transparent ones wait in
+           the k-buffer until flush().
+*/
+void
+RenderPipeline3D::storeFragment(RASTERIZED_FRAGMENT &frag, VEC3 pos_origin, float depth) {
+    shadeFragment(frag, pos_origin);
+    if (frag.color.w < 1.0f) {
+        insertTransparent(frag.posX, frag.posY, depth, frag.color);
+        return;
+    }
+    (*zBuffer)[frag.posX + frag.posY * canvas->w] = depth;
+    canvas->setPixel(frag.posX, frag.posY, frag.color);
+}
+
+/*
+    \brief Pixel bounds of a triangle.
+           In this implementation, i just throw the out-of-range triangles
+           out, a triangle is kept if any of its vertexes is in the view.
+    \returns false if the triangle is clipped or covers no pixel
+*/
+bool
+RenderPipeline3D::getTriangleRect(VEC4 v_homo[3], SCREEN_RECT &rect) {
+    bool is_clipped = true;
+#define MIN(a,b) ((a)>(b)?(b):(a))
+#define MAX(a,b) ((a)>(b)?(a):(b))
+    float minX=1, minY=1, maxX=-1, maxY=-1;
+    for (size_t i = 0; i < 3; ++i) {
+        float x = v_homo[i].getx(), y = v_homo[i].gety(), z = v_homo[i].z;
+        if (x >= -1 && x <= 1 && y >= -1 && y <= 1 && z >= camera->nearZ && z <= camera->farZ) {
+            is_clipped = false;
+        }
+        minX = MIN(minX, x);
+        minY = MIN(minY, y);
+        maxX = MAX(maxX, x);
+        maxY = MAX(maxY, y);
+    }
+    if (is_clipped) return false;
+    /*
+     ^ y         O---> x
+     |       ->  |        SCREEN COORDINATE
+     O---> x     v y
+    */
+    minX = (float)(MAX(-1,minX)+1)/2*canvas->w;
+    minY = (float)(-MAX(-1,minY)+1)/2*canvas->h;
+    maxX = (float)(MIN(1,maxX)+1)/2*canvas->w;
+    maxY = (float)(-MIN(1,maxY)+1)/2*canvas->h;
+    swap(minY, maxY);
+    rect.x0 = (int)minX;
+    rect.y0 = (int)minY;
+    rect.x1 = MIN((int)maxX, (int)canvas->w - 1);
+    rect.y1 = MIN((int)maxY, (int)canvas->h - 1);
+#undef MIN
+#undef MAX
+    return !rect.empty();
+}
+
+/*
+    \brief Union of the pixel bounds of all triangles of a mesh.
+*/
+SCREEN_RECT
+RenderPipeline3D::getMeshRect(MESH mesh, vector<VEC4> *verts_homo) {
+    SCREEN_RECT bounds = {0, 0, -1, -1};
+    size_t p = 0;
+    for (size_t i = 0; i < mesh.faceIndex->size(); p += (*mesh.faceIndex)[i], ++i) {
+        if ((*mesh.faceIndex)[i] != 3) continue;
+        VEC4 v_homo[3];
+        for (size_t j = 0; j < 3; ++j)
+            v_homo[j] = (*verts_homo)[(*mesh.vertexIndex)[p+j]];
+        SCREEN_RECT rect;
+        if (getTriangleRect(v_homo, rect)) bounds = bounds.merge(rect);
+    }
+    return bounds;
+}
+
+/*
+    \brief World space -> camera space of a viewer at `position` looking
+           along `rotation` (pitch, yaw, roll).
+*/
+MATRIX4
+RenderPipeline3D::getViewMatrix(VEC3 position, VEC3 rotation) {
+    return Math::matrixMul(
+        Math::pitch_yaw_roll(-rotation.x, -rotation.y, -rotation.z),
+        Math::translation(-position.x, -position.y, -position.z)
+    );
+}
+
 /*
     \brief World space -> Homogenous Clipping Space
     \returns vertexes in homogenous clipping space
@@ -225,48 +313,178 @@ RenderPipeline3D::renderTriangle(
 */
 vector<VEC4> *
 RenderPipeline3D::getVertexClipSpace(vector<VEC3> *verts) {
-    vector<VEC4> *verts_homo = new vector<VEC4>;
-    /* cam transform */
-    MATRIX4 m_cam_space_trans = Math::matrixMul(
-        Math::pitch_yaw_roll(-camera->rotation.x, -camera->rotation.y, -camera->rotation.z),
-        Math::translation(-camera->position.x, -camera->position.y, -camera->position.z)
-    );
+    vector<VEC4> *verts_homo = new vector<VEC4>(verts->size());
+    /* the view matrix is affine (w stays 1), so view and projection are
+       folded into one matrix and applied in a single pass */
+    MATRIX4 m_cam_space_trans = getViewMatrix(camera->position, camera->rotation);
     MATRIX4 m_homo_space_trans = Math::projection(camera->fovY, camera->aspect_ratio, camera->nearZ, camera->farZ);
+    MATRIX4 m_trans = Math::matrixMul(m_homo_space_trans, m_cam_space_trans);
 
-    for (size_t i = 0; i < verts->size(); ++i) {
-        VEC3 cur_v = (*verts)[i];
-        VEC4 vert4 = (VEC4){cur_v.x, cur_v.y, cur_v.z, 1.0f};
-        vert4 = Math::matrixVecMul(m_cam_space_trans, vert4);
-        vert4.regularize();
-        vert4 = Math::matrixVecMul(m_homo_space_trans, vert4);
-        verts_homo->push_back(vert4);
-    }
+    if (!verts->empty())
+        Math::transformPoints(m_trans, verts->data(), verts_homo->data(), verts->size());
     
     return verts_homo;
 }
 
+/*
+    \brief Reset color and depth of the pixels inside `rect`.
+*/
+void
+RenderPipeline3D::clearRect(SCREEN_RECT rect) {
+    for (int y = rect.y0; y <= rect.y1; ++y) {
+        for (int x = rect.x0; x <= rect.x1; ++x) {
+            unsigned p = x + y * canvas->w;
+            (*zBuffer)[p] = INFINITY;
+            canvas->img[p*3] = canvas->img[p*3+1] = canvas->img[p*3+2] = 0;
+            if (oitCount != nullptr) (*oitCount)[p] = 0;
+        }
+    }
+}
+
+/* `front` over `back`, straight alpha */
+static COLOR4
+blendOver(COLOR4 front, COLOR4 back) {
+    float a = front.w + back.w * (1 - front.w);
+    if (a <= 0) return (COLOR4){0, 0, 0, 0};
+    float kb = back.w * (1 - front.w);
+    return (COLOR4){(front.x * front.w + back.x * kb) / a,
+                    (front.y * front.w + back.y * kb) / a,
+                    (front.z * front.w + back.z * kb) / a, a};
+}
+
+/*
+    \brief Keep a transparent fragment in the k-buffer of pixel (x, y),
+           sorted nearest first. A full list merges its two farthest
+           fragments, so memory stays at OIT_LAYERS fragments per pixel and
+           only the blending of the farthest layers is approximated.
+*/
+void
+RenderPipeline3D::insertTransparent(unsigned x, unsigned y, float depth, COLOR4 color) {
+    unsigned pixels = canvas->w * canvas->h;
+    if (oitCount == nullptr) {
+        oitCount = new vector<unsigned char>(pixels, 0);
+        oitBuffer = new vector<OIT_FRAGMENT>(pixels * OIT_LAYERS);
+    }
+    unsigned p = x + y * canvas->w;
+    OIT_FRAGMENT *f = &(*oitBuffer)[p * OIT_LAYERS];
+    unsigned n = (*oitCount)[p];
+
+    bool full = n == OIT_LAYERS;
+    OIT_FRAGMENT evicted;
+    if (full) {
+        if (depth >= f[n-1].depth) {
+            f[n-1].color = Packing::packColor(blendOver(Packing::unpackColor(f[n-1].color), color));
+            return;
+        }
+        evicted = f[--n];
+    }
+    unsigned i = n;
+    for (; i > 0 && f[i-1].depth > depth; --i) f[i] = f[i-1];
+    f[i].depth = depth;
+    f[i].color = Packing::packColor(color);
+    ++n;
+    if (full)
+        f[n-1].color = Packing::packColor(blendOver(Packing::unpackColor(f[n-1].color),
+                                                    Packing::unpackColor(evicted.color)));
+    (*oitCount)[p] = n;
+}
+
+/*
+    \brief Blend the k-buffer of the pixels in `rect` over the canvas and
+           empty it. Fragments behind an opaque surface drawn after them
+           are dropped here, so the draw order does not matter.
+*/
+void
+RenderPipeline3D::resolveTransparent(SCREEN_RECT rect) {
+    if (oitCount == nullptr) return;
+    for (int y = rect.y0; y <= rect.y1; ++y) {
+        for (int x = rect.x0; x <= rect.x1; ++x) {
+            unsigned p = x + y * canvas->w;
+            unsigned n = (*oitCount)[p];
+            if (n == 0) continue;
+            OIT_FRAGMENT *f = &(*oitBuffer)[p * OIT_LAYERS];
+            COLOR4 sum = {0, 0, 0, 0};
+            for (unsigned i = 0; i < n && f[i].depth <= (*zBuffer)[p]; ++i)
+                sum = blendOver(sum, Packing::unpackColor(f[i].color));
+            if (sum.w > 0) canvas->blendPixel(x, y, sum);
+            (*oitCount)[p] = 0;
+        }
+    }
+}
+
+/*
+    \brief Start a frame. In retained mode the canvas keeps the previous
+           frame, which flush() then patches.
+*/
 void
 RenderPipeline3D::init() {
+    frameStart = chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+
+    /* render target of this frame */
+    if (resolution != nullptr) {
+        float scale = resolution->getScale();
+        unsigned w = max(1u, (unsigned)(output->w * scale + 0.5f));
+        unsigned h = max(1u, (unsigned)(output->h * scale + 0.5f));
+        if (target == nullptr || target->w != w || target->h != h) {
+            delete target;
+            target = new CANVAS(w, h);
+        }
+        canvas = target;
+    } else {
+        canvas = output;
+    }
     
-    if (fragment == nullptr)
-        fragment = new vector<RASTERIZED_FRAGMENT>;
-    else
-        fragment->clear();
-        
     if (zBuffer == nullptr)
         zBuffer = new vector<float>;
+    scissor = (SCREEN_RECT){0, 0, (int)canvas->w - 1, (int)canvas->h - 1};
+    if (zBuffer->size() != canvas->w * canvas->h) {
+        zBuffer->assign(canvas->w * canvas->h, INFINITY);
+        /* nothing drawn before can be reused */
+        if (history != nullptr) history->clear();
+    }
+    if (oitCount != nullptr && oitCount->size() != canvas->w * canvas->h) {
+        oitCount->assign(canvas->w * canvas->h, 0);
+        oitBuffer->resize(canvas->w * canvas->h * OIT_LAYERS);
+    }
+
+    if (draws == nullptr)
+        draws = new vector<DRAW_CALL>;
     else
-        zBuffer->clear();
+        draws->clear();
 
     if (light == nullptr)
         light = new vector<LIGHT>;
     else
         light->clear();
+
+    /* shadow maps survive as a cache, casters are resubmitted per frame */
+    if (caster == nullptr)
+        caster = new vector<MESH>;
+    else
+        caster->clear();
+    shadowReady = false;
         
     texture = nullptr;
     material = nullptr;
     
-    canvas->clear();
+    if (!retained) {
+        canvas->clear();
+        fill(zBuffer->begin(), zBuffer->end(), INFINITY);
+        if (oitCount != nullptr) fill(oitCount->begin(), oitCount->end(), 0);
+    }
+}
+
+/*
+    \brief Canvas the next frame is rendered to, takes effect at init().
+*/
+void
+RenderPipeline3D::setCanvas(CANVAS *cav) {
+    output = cav;
+}
+
+void
+RenderPipeline3D::setCamera(CAMERA *cam) {
+    camera = cam;
 }
 
 void
@@ -282,6 +500,275 @@ RenderPipeline3D::setMaterial(MATERIAL *mat) {
 void
 RenderPipeline3D::addLight(LIGHT lgt) {
     light->push_back(lgt);
+    shadowReady = false;
+}
+
+/*
+    \brief Configure shadow mapping for lights with mCastShadow set.
+    \param map_size: shadow map resolution per face, 0 disables shadows
+    \param pcf_radius: percentage closer filter radius in texels, 0 for a
+           single hard sample
+    \param bias: depth offset in world units against self shadowing
+*/
+void
+RenderPipeline3D::setShadow(unsigned map_size, unsigned pcf_radius, float bias) {
+    shadowMapSize = map_size;
+    shadowPCF = pcf_radius;
+    shadowBias = bias;
+    shadowReady = false;
+}
+
+/*
+    \brief Register a mesh that occludes lights this frame. Casters and
+           lights must be added before the first render() of the frame.
+*/
+void
+RenderPipeline3D::addShadowCaster(MESH mesh) {
+    caster->push_back(mesh);
+    shadowReady = false;
+}
+
+/*
+    \brief Render the shadow maps of this frame's lights and casters now
+           instead of at the first render().
+    \returns the maps, owned by this pipeline and valid until its next frame
+*/
+vector<SHADOW_MAP> *
+RenderPipeline3D::prepareShadowMaps() {
+    updateShadowMaps();
+    return shadowMap;
+}
+
+/*
+    \brief Shade this frame with maps prepared by another pipeline for the
+           same lights, casters and shadow settings. Call after the lights
+           are added; the maps are only read.
+*/
+void
+RenderPipeline3D::shareShadowMaps(vector<SHADOW_MAP> *maps) {
+    shadowMap = maps;
+    shadowReady = true;
+}
+
+/* near plane of the shadow map projections, in view distance */
+static const float SHADOW_NEAR = 0.05f;
+
+/*
+    \brief Fill one triangle into a shadow map face, keeping the nearest
+           depth per texel.
+    \param a, b, c: x, y in texels and 1/w of the corners
+    \param za, zb, zc: z/w of the corners
+*/
+static void
+rasterizeDepth(float *buf, unsigned size, VEC3 a, VEC3 b, VEC3 c, float za, float zb, float zc) {
+    float sz = (float)size;
+    float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    if (fabs(area) < 1e-12f) return;
+
+    int minX = (int)max(0.0f, floorf(min(a.x, min(b.x, c.x))));
+    int minY = (int)max(0.0f, floorf(min(a.y, min(b.y, c.y))));
+    int maxX = (int)min(sz - 1, ceilf(max(a.x, max(b.x, c.x))));
+    int maxY = (int)min(sz - 1, ceilf(max(a.y, max(b.y, c.y))));
+    if (minX > maxX || minY > maxY) return;
+
+    /* edge functions normalized to barycentrics, stepped per texel */
+    float inv = 1.0f / area;
+    float ax0 = (b.y - c.y) * inv, ay0 = (c.x - b.x) * inv;
+    float ax1 = (c.y - a.y) * inv, ay1 = (a.x - c.x) * inv;
+    float px = minX + 0.5f, py = minY + 0.5f;
+    float w0r = ((c.x - b.x) * (py - b.y) - (c.y - b.y) * (px - b.x)) * inv;
+    float w1r = ((a.x - c.x) * (py - c.y) - (a.y - c.y) * (px - c.x)) * inv;
+    for (int y = minY; y <= maxY; ++y, w0r += ay0, w1r += ay1) {
+        float w0 = w0r, w1 = w1r;
+        float *row = buf + (size_t)y * size;
+        for (int x = minX; x <= maxX; ++x, w0 += ax0, w1 += ax1) {
+            float w2 = 1.0f - w0 - w1;
+            if (w0 < 0 || w1 < 0 || w2 < 0) continue;
+            float depth = (w0 * za + w1 * zb + w2 * zc) / (w0 * a.z + w1 * b.z + w2 * c.z);
+            if (depth < row[x]) row[x] = depth;
+        }
+    }
+}
+
+/*
+    \brief Depth-only rasterization of one mesh into a shadow map face.
+           No attributes are interpolated and nothing is shaded, only the
+           nearest view depth per texel is kept. Triangles crossing the
+           near plane are clipped to it, a caster spanning several cube
+           faces is then complete in each of them.
+*/
+void
+RenderPipeline3D::renderDepth(SHADOW_MAP &sm, unsigned face, MESH mesh) {
+    vector<VEC3> &verts = *mesh.verts;
+    vector<VEC4> clip(verts.size());            /* light clip space           */
+    vector<VEC3> scr(verts.size());             /* x, y in texels, 1/w        */
+    vector<float> zw(verts.size());             /* z/w                        */
+    const MATRIX4 &m = sm.viewProj[face];
+    float sz = (float)sm.size;
+#define TO_TEXELS(c, out, out_z) do { float iw = 1.0f / (c).w; \
+        out = (VEC3){((c).x * iw + 1) / 2 * sz, (1 - (c).y * iw) / 2 * sz, iw}; out_z = (c).z * iw; } while (0)
+    for (size_t i = 0; i < verts.size(); ++i) {
+        clip[i] = Math::matrixVecMul(m, (VEC4){verts[i].x, verts[i].y, verts[i].z, 1.0f});
+        if (clip[i].w >= SHADOW_NEAR) TO_TEXELS(clip[i], scr[i], zw[i]);
+    }
+
+    float *buf = &sm.depth[(size_t)face * sm.size * sm.size];
+    vector<unsigned> &idx = *mesh.vertexIndex;
+    size_t p = 0;
+    for (size_t f = 0; f < mesh.faceIndex->size(); p += (*mesh.faceIndex)[f], ++f) {
+        if ((*mesh.faceIndex)[f] != 3) continue;
+        unsigned i0 = idx[p], i1 = idx[p+1], i2 = idx[p+2];
+        bool in0 = clip[i0].w >= SHADOW_NEAR, in1 = clip[i1].w >= SHADOW_NEAR, in2 = clip[i2].w >= SHADOW_NEAR;
+        if (in0 && in1 && in2) {
+            rasterizeDepth(buf, sm.size, scr[i0], scr[i1], scr[i2], zw[i0], zw[i1], zw[i2]);
+            continue;
+        }
+        if (!in0 && !in1 && !in2) continue;
+
+        /* Sutherland-Hodgman against w = SHADOW_NEAR, one plane leaves at
+           most four corners */
+        VEC4 tri[3] = {clip[i0], clip[i1], clip[i2]}, poly[4];
+        unsigned n = 0;
+        for (int k = 0; k < 3; ++k) {
+            const VEC4 &u = tri[k], &v = tri[(k + 1) % 3];
+            bool u_in = u.w >= SHADOW_NEAR, v_in = v.w >= SHADOW_NEAR;
+            if (u_in) poly[n++] = u;
+            if (u_in != v_in) {
+                float t = (SHADOW_NEAR - u.w) / (v.w - u.w);
+                poly[n++] = u + (v - u) * t;
+            }
+        }
+        VEC3 ps[4];
+        float pz[4];
+        for (unsigned k = 0; k < n; ++k) TO_TEXELS(poly[k], ps[k], pz[k]);
+        for (unsigned k = 1; k + 1 < n; ++k)
+            rasterizeDepth(buf, sm.size, ps[0], ps[k], ps[k+1], pz[0], pz[k], pz[k+1]);
+    }
+#undef TO_TEXELS
+}
+
+/*
+    \brief Re-render the shadow maps whose light or casters changed since
+           they were last rendered.
+*/
+void
+RenderPipeline3D::updateShadowMaps() {
+    shadowReady = true;
+    if (shadowMapSize == 0 || light == nullptr) return;
+    if (shadowMap == nullptr) shadowMap = new vector<SHADOW_MAP>;
+    if (shadowMap->size() < light->size()) shadowMap->resize(light->size());
+
+    unsigned long long caster_key = hashBytes(&shadowMapSize, sizeof(shadowMapSize));
+    for (size_t i = 0; i < caster->size(); ++i) {
+        MESH &m = (*caster)[i];
+        caster_key = hashBytes(m.verts->data(), m.verts->size() * sizeof(VEC3), caster_key);
+        caster_key = hashBytes(m.faceIndex->data(), m.faceIndex->size() * sizeof(unsigned), caster_key);
+        caster_key = hashBytes(m.vertexIndex->data(), m.vertexIndex->size() * sizeof(unsigned), caster_key);
+    }
+
+    bool bounded = false;
+    VEC3 center = {0, 0, 0};
+    float radius = 0;
+    for (size_t i = 0; i < light->size(); ++i) {
+        LIGHT &l = (*light)[i];
+        SHADOW_MAP &sm = (*shadowMap)[i];
+        if (!l.mIsEnabled || !l.mCastShadow) continue;
+
+        unsigned long long key = hashBytes(&l.mType, sizeof(l.mType), caster_key);
+        key = hashBytes(l.mType == L_POINT ? &l.mPosition : &l.mDirection, sizeof(VEC3), key);
+        if (sm.faces != 0 && sm.key == key) continue;
+        sm.key = key;
+        sm.size = shadowMapSize;
+
+        if (l.mType == L_POINT) {
+            VEC3 dirs[6] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+            MATRIX4 proj = Math::projection(Math::Pi / 2.0f, 1.0f, SHADOW_NEAR, 100.0f);
+            sm.faces = 6;
+            sm.perspective = true;
+            for (unsigned f = 0; f < 6; ++f) {
+                CAMERA cam;
+                cam.position = l.mPosition;
+                cam.lookAt(l.mPosition.x + dirs[f].x, l.mPosition.y + dirs[f].y, l.mPosition.z + dirs[f].z);
+                sm.viewProj[f] = Math::matrixMul(proj, getViewMatrix(cam.position, cam.rotation));
+            }
+        } else {
+            /* fit an orthographic box around the casters' bounding sphere */
+            if (!bounded) {
+                bounded = true;
+                VEC3 lo = {1e30f, 1e30f, 1e30f}, hi = {-1e30f, -1e30f, -1e30f};
+                for (size_t c = 0; c < caster->size(); ++c) {
+                    vector<VEC3> &v = *(*caster)[c].verts;
+                    for (size_t k = 0; k < v.size(); ++k) {
+                        lo.x = min(lo.x, v[k].x); lo.y = min(lo.y, v[k].y); lo.z = min(lo.z, v[k].z);
+                        hi.x = max(hi.x, v[k].x); hi.y = max(hi.y, v[k].y); hi.z = max(hi.z, v[k].z);
+                    }
+                }
+                if (lo.x <= hi.x) {
+                    center = (lo + hi) / 2.0f;
+                    VEC3 d = hi - center;
+                    radius = sqrt(d * d);
+                }
+                if (radius <= 0) radius = 1.0f;
+            }
+            VEC3 dir = l.mDirection.normalize();
+            CAMERA cam;
+            cam.position = center - dir * (radius * 2.0f);
+            cam.lookAt(center.x, center.y, center.z);
+            sm.faces = 1;
+            sm.perspective = false;
+            sm.viewProj[0] = Math::matrixMul(Math::orthographic(radius * 2.0f, radius * 2.0f),
+                                             getViewMatrix(cam.position, cam.rotation));
+        }
+
+        sm.depth.assign((size_t)sm.faces * sm.size * sm.size, INFINITY);
+        for (unsigned f = 0; f < sm.faces; ++f)
+            for (size_t c = 0; c < caster->size(); ++c)
+                renderDepth(sm, f, (*caster)[c]);
+    }
+}
+
+/*
+    \brief Fraction of light `light_idx` reaching world position `pos`,
+           filtered over (2 * shadowPCF + 1)^2 texels.
+*/
+float
+RenderPipeline3D::shadowFactor(unsigned light_idx, VEC3 pos) {
+    if (shadowMapSize == 0 || shadowMap == nullptr || light_idx >= shadowMap->size())
+        return 1.0f;
+    if (!(*light)[light_idx].mCastShadow) return 1.0f;
+    SHADOW_MAP &sm = (*shadowMap)[light_idx];
+    if (sm.faces == 0) return 1.0f;
+
+    unsigned face = 0;
+    if (sm.faces == 6) {
+        VEC3 d = pos - (*light)[light_idx].mPosition;
+        float ax = fabs(d.x), ay = fabs(d.y), az = fabs(d.z);
+        if (ax >= ay && ax >= az) face = d.x > 0 ? 0 : 1;
+        else if (ay >= az) face = d.y > 0 ? 2 : 3;
+        else face = d.z > 0 ? 4 : 5;
+    }
+    VEC4 c = Math::matrixVecMul(sm.viewProj[face], (VEC4){pos.x, pos.y, pos.z, 1.0f});
+    if (c.w <= 0) return 1.0f;
+    float u = (c.x / c.w + 1) / 2 * sm.size, v = (1 - c.y / c.w) / 2 * sm.size;
+    /* a texel covers more surface further away from a point light */
+    float texel = sm.perspective ? 2.0f * c.w / sm.size :
+                  2.0f / (sqrt(sm.viewProj[face].mat[0][0] * sm.viewProj[face].mat[0][0] +
+                               sm.viewProj[face].mat[0][1] * sm.viewProj[face].mat[0][1] +
+                               sm.viewProj[face].mat[0][2] * sm.viewProj[face].mat[0][2]) * sm.size);
+    float depth = c.z - shadowBias - texel * 1.5f;
+
+    int cx = (int)floorf(u), cy = (int)floorf(v), r = shadowPCF, last = sm.size - 1;
+    const float *buf = &sm.depth[(size_t)face * sm.size * sm.size];
+    unsigned lit = 0, total = 0;
+    for (int dy = -r; dy <= r; ++dy) {
+        int y = min(max(cy + dy, 0), last);
+        for (int dx = -r; dx <= r; ++dx) {
+            int x = min(max(cx + dx, 0), last);
+            ++total;
+            if (depth <= buf[(size_t)y * sm.size + x]) ++lit;
+        }
+    }
+    return (float)lit / total;
 }
 
 /*
@@ -290,28 +777,378 @@ RenderPipeline3D::addLight(LIGHT lgt) {
 */
 void 
 RenderPipeline3D::render(MESH mesh) {
+    if (retained) {
+        draws->push_back((DRAW_CALL){mesh, texture, material});
+        return;
+    }
+    if (!shadowReady) updateShadowMaps();
     /* vertex_homo */
+    vector<VEC4> *verts_homo = getVertexClipSpace(mesh.verts);
+    drawMesh(mesh, verts_homo);
+    delete verts_homo;
+}
+
+/*
+    \brief Rasterize the triangles of a mesh already in clip space.
+*/
+void
+RenderPipeline3D::drawMesh(MESH mesh, vector<VEC4> *verts_homo) {
     vector<VEC3> *verts = mesh.verts;
-    vector<VEC4> *verts_homo = getVertexClipSpace(verts);
     
+    /* packed attributes are decoded a block of corners at a time, so the
+       decoded copy stays in cache */
+    const size_t BLOCK = 1024;
+    bool packed = mesh.normal == nullptr;
+    VEC3 block_normal[BLOCK];
+    VEC2 block_tex_coord[BLOCK];
+    size_t block_begin = 0, block_end = 0;
+
     /* draw triangle faces */
     vector<unsigned> *faceIndex = mesh.faceIndex;
+    vector<unsigned> tri_verts;
+    vector<VEC3> tri_normal;
+    vector<VEC2> tri_tex_coord;
     size_t p = 0;
     for (size_t i = 0; i < faceIndex->size(); ++i) {
-        vector<unsigned> tri_verts;
-        vector<VEC3> tri_normal;
-        vector<VEC2> tri_tex_coord;
         tri_verts.clear();
         tri_normal.clear();
         tri_tex_coord.clear();
+        if (packed && p + (*faceIndex)[i] > block_end) {
+            block_begin = p;
+            block_end = min(p + BLOCK, mesh.vertexIndex->size());
+            Packing::unpackNormals(&(*mesh.normalPacked)[p * 2], block_normal, block_end - p);
+            Packing::unpackTexCoords(&(*mesh.texCoordPacked)[p * 2], block_tex_coord, block_end - p);
+        }
         for (size_t j = 0; j < (*faceIndex)[i]; ++j, ++p) {
             tri_verts.push_back((*(mesh.vertexIndex))[p]);
-            tri_normal.push_back((*mesh.normal)[p]);
-            tri_tex_coord.push_back((*mesh.texCoord)[p]);
+            tri_normal.push_back(packed ? block_normal[p - block_begin] : (*mesh.normal)[p]);
+            tri_tex_coord.push_back(packed ? block_tex_coord[p - block_begin] : (*mesh.texCoord)[p]);
         }
         renderTriangle(verts, verts_homo, &tri_normal, &tri_tex_coord, &tri_verts);
     }
-    delete verts_homo;
 }
 
-}
\ No newline at end of file
+/*
+    \brief Hash of everything that affects every pixel: canvas size, camera,
+           lights and the shadow maps in use.
+*/
+unsigned long long
+RenderPipeline3D::getFrameKey() {
+    /* another canvas, even of the same size, never held the last frame */
+    unsigned long long key = hashBytes(&canvas, sizeof(canvas));
+    key = hashBytes(&canvas->w, sizeof(canvas->w), key);
+    key = hashBytes(&canvas->h, sizeof(canvas->h), key);
+    key = hashBytes(&camera->position, sizeof(VEC3), key);
+    key = hashBytes(&camera->rotation, sizeof(VEC3), key);
+    key = hashBytes(&camera->fovY, sizeof(float), key);
+    key = hashBytes(&camera->nearZ, sizeof(float), key);
+    key = hashBytes(&camera->farZ, sizeof(float), key);
+    key = hashBytes(&camera->aspect_ratio, sizeof(float), key);
+    key = hashBytes(&shadowMapSize, sizeof(shadowMapSize), key);
+    key = hashBytes(&shadowPCF, sizeof(shadowPCF), key);
+    key = hashBytes(&shadowBias, sizeof(shadowBias), key);
+    for (size_t i = 0; i < light->size(); ++i) {
+        LIGHT &l = (*light)[i];
+        key = hashBytes(&l.mType, sizeof(l.mType), key);
+        key = hashBytes(&l.mAmbientColor, sizeof(COLOR3), key);
+        key = hashBytes(&l.mDiffuseColor, sizeof(COLOR3), key);
+        key = hashBytes(&l.mSpecularColor, sizeof(COLOR3), key);
+        key = hashBytes(&l.mPosition, sizeof(VEC3), key);
+        key = hashBytes(&l.mDirection, sizeof(VEC3), key);
+        key = hashBytes(&l.mSpecularIntensity, sizeof(float), key);
+        key = hashBytes(&l.mDiffuseIntensity, sizeof(float), key);
+        key = hashBytes(&l.mIsEnabled, sizeof(bool), key);
+        key = hashBytes(&l.mCastShadow, sizeof(bool), key);
+        if (shadowMap != nullptr && i < shadowMap->size() && l.mCastShadow)
+            key = hashBytes(&(*shadowMap)[i].key, sizeof(unsigned long long), key);
+    }
+    return key;
+}
+
+/*
+    \brief Switch between immediate mode, where render() rasterizes right
+           away, and retained mode, where draws are collected until flush().
+*/
+void
+RenderPipeline3D::setRetained(bool enable) {
+    retained = enable;
+    if (history != nullptr) history->clear();
+}
+
+/*
+    \brief Render into a target scaled by `controller` and upscale it into
+           the canvas in flush(), which also reports the frame time to the
+           controller. nullptr renders at canvas size again.
+*/
+void
+RenderPipeline3D::setDynamicResolution(ResolutionController *controller) {
+    resolution = controller;
+}
+
+/*
+    \brief Separable bilinear resize, a horizontal pass into 8.8 fixed
+           point rows and a vertical pass over those.
+*/
+static void
+resizeBilinear(const CANVAS &src, CANVAS &dst) {
+    if (src.w == dst.w && src.h == dst.h) {
+        memcpy(dst.img, src.img, src.w * src.h * 3);
+        return;
+    }
+    /* source taps and 8 bit weights of the second tap, pixel centers align */
+    struct TAP { unsigned i0, i1, f; };
+    vector<TAP> tx(dst.w), ty(dst.h);
+    for (int axis = 0; axis < 2; ++axis) {
+        vector<TAP> &taps = axis ? ty : tx;
+        unsigned sn = axis ? src.h : src.w, dn = axis ? dst.h : dst.w;
+        for (unsigned d = 0; d < dn; ++d) {
+            float s = (d + 0.5f) * sn / dn - 0.5f;
+            if (s < 0) s = 0;
+            unsigned i = min((unsigned)s, sn - 1);
+            taps[d].i0 = i;
+            taps[d].i1 = min(i + 1, sn - 1);
+            taps[d].f = (unsigned)((s - i) * 256.0f + 0.5f);
+        }
+    }
+
+    vector<unsigned short> rows(src.h * dst.w * 3);
+    for (unsigned y = 0; y < src.h; ++y) {
+        const unsigned char *in = src.img + y * src.w * 3;
+        unsigned short *out = &rows[y * dst.w * 3];
+        for (unsigned x = 0; x < dst.w; ++x) {
+            const unsigned char *a = in + tx[x].i0 * 3, *b = in + tx[x].i1 * 3;
+            unsigned f = tx[x].f;
+            for (int c = 0; c < 3; ++c) out[x * 3 + c] = a[c] * (256 - f) + b[c] * f;
+        }
+    }
+    for (unsigned y = 0; y < dst.h; ++y) {
+        const unsigned short *a = &rows[ty[y].i0 * dst.w * 3], *b = &rows[ty[y].i1 * dst.w * 3];
+        unsigned f = ty[y].f;
+        unsigned char *out = dst.img + y * dst.w * 3;
+        for (unsigned i = 0; i < dst.w * 3; ++i)
+            out[i] = (a[i] * (256 - f) + b[i] * f + 32768) >> 16;
+    }
+}
+
+/*
+    \brief End a frame. Transparent fragments are blended over the canvas
+           here in both modes. With dynamic resolution the scaled target is
+           then upscaled into the canvas and the controller is told how
+           long the frame took since init().
+*/
+void
+RenderPipeline3D::flush() {
+    if (retained)
+        flushRetained();
+    else
+        resolveTransparent((SCREEN_RECT){0, 0, (int)canvas->w - 1, (int)canvas->h - 1});
+
+    if (resolution != nullptr && canvas != output) {
+        resizeBilinear(*canvas, *output);
+        double now = chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+        resolution->update(now - frameStart);
+    }
+}
+
+/*
+    \brief In retained mode the draws of this frame are compared with the
+           previous frame's by position in the draw list; only the screen
+           regions of draws that were added, removed or changed are cleared
+           and re-rasterized, and only the triangles touching those regions
+           are filled. A change of camera, lights or shadows redraws
+           everything.
+*/
+void
+RenderPipeline3D::flushRetained() {
+    if (!shadowReady) updateShadowMaps();
+    if (history == nullptr) history = new vector<DRAW_RECORD>;
+
+    /* this frame's draws */
+    vector<DRAW_RECORD> records(draws->size());
+    vector<vector<VEC4> *> verts_homo(draws->size());
+    for (size_t i = 0; i < draws->size(); ++i) {
+        DRAW_CALL &d = (*draws)[i];
+        unsigned long long key = hashBytes(d.mesh.verts->data(), d.mesh.verts->size() * sizeof(VEC3));
+        key = hashBytes(d.mesh.faceIndex->data(), d.mesh.faceIndex->size() * sizeof(unsigned), key);
+        key = hashBytes(d.mesh.vertexIndex->data(), d.mesh.vertexIndex->size() * sizeof(unsigned), key);
+        if (d.mesh.normal != nullptr) {
+            key = hashBytes(d.mesh.normal->data(), d.mesh.normal->size() * sizeof(VEC3), key);
+            key = hashBytes(d.mesh.texCoord->data(), d.mesh.texCoord->size() * sizeof(VEC2), key);
+        } else {
+            key = hashBytes(d.mesh.normalPacked->data(), d.mesh.normalPacked->size() * sizeof(short), key);
+            key = hashBytes(d.mesh.texCoordPacked->data(), d.mesh.texCoordPacked->size() * sizeof(short), key);
+        }
+        if (d.texture != nullptr) {
+            TEXTURE &t = *d.texture;
+            key = hashBytes(&t.ty, sizeof(t.ty), key);
+            if (t.ty == T_CHESS_BOARD) {
+                key = hashBytes(&t.sz, sizeof(t.sz), key);
+                key = hashBytes(&t.color1, sizeof(COLOR4), key);
+                key = hashBytes(&t.color2, sizeof(COLOR4), key);
+            } else {
+                key = hashBytes(&t.color, sizeof(COLOR4), key);
+            }
+        }
+        if (d.material != nullptr) {
+            MATERIAL &m = *d.material;
+            key = hashBytes(&m.ambient, sizeof(COLOR3), key);
+            key = hashBytes(&m.diffuse, sizeof(COLOR3), key);
+            key = hashBytes(&m.specular, sizeof(COLOR3), key);
+            key = hashBytes(&m.specularSmoothLevel, sizeof(unsigned), key);
+            key = hashBytes(&m.opacity, sizeof(float), key);
+        }
+        verts_homo[i] = getVertexClipSpace(d.mesh.verts);
+        records[i].key = key;
+        records[i].bounds = getMeshRect(d.mesh, verts_homo[i]);
+    }
+
+    /* dirty regions */
+    SCREEN_RECT full = {0, 0, (int)canvas->w - 1, (int)canvas->h - 1};
+    vector<SCREEN_RECT> dirty;
+    unsigned long long key = getFrameKey();
+    if (key != frameKey || history->empty()) {
+        dirty.push_back(full);
+    } else {
+        for (size_t i = 0; i < max(records.size(), history->size()); ++i) {
+            if (i >= history->size()) {
+                dirty.push_back(records[i].bounds);
+            } else if (i >= records.size()) {
+                dirty.push_back((*history)[i].bounds);
+            } else if (records[i].key != (*history)[i].key) {
+                dirty.push_back((*history)[i].bounds);
+                dirty.push_back(records[i].bounds);
+            }
+        }
+    }
+    /* merge touching regions until none are left, too many small ones
+       become their union */
+    for (size_t i = 0; i < dirty.size(); ) {
+        if (dirty[i].empty()) dirty.erase(dirty.begin() + i);
+        else ++i;
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < dirty.size() && !changed; ++i) {
+            for (size_t j = 0; j < i; ++j) {
+                SCREEN_RECT grown = {dirty[j].x0 - 1, dirty[j].y0 - 1, dirty[j].x1 + 1, dirty[j].y1 + 1};
+                if (grown.intersect(dirty[i]).empty()) continue;
+                dirty[j] = dirty[j].merge(dirty[i]);
+                dirty.erase(dirty.begin() + i);
+                changed = true;
+                break;
+            }
+        }
+    }
+    if (dirty.size() > 16) {
+        SCREEN_RECT all = {0, 0, -1, -1};
+        for (size_t i = 0; i < dirty.size(); ++i) all = all.merge(dirty[i]);
+        dirty.assign(1, all);
+    }
+
+    /* patch them */
+    TEXTURE *bound_texture = texture;
+    MATERIAL *bound_material = material;
+    for (size_t r = 0; r < dirty.size(); ++r) {
+        scissor = dirty[r].intersect(full);
+        clearRect(scissor);
+        for (size_t i = 0; i < draws->size(); ++i) {
+            if (records[i].bounds.intersect(scissor).empty()) continue;
+            texture = (*draws)[i].texture;
+            material = (*draws)[i].material;
+            drawMesh((*draws)[i].mesh, verts_homo[i]);
+        }
+        resolveTransparent(scissor);
+    }
+    scissor = full;
+    texture = bound_texture;
+    material = bound_material;
+
+    for (size_t i = 0; i < verts_homo.size(); ++i) delete verts_homo[i];
+    history->swap(records);
+    frameKey = key;
+}
+
+ResolutionController::ResolutionController(double budget_seconds, float min_scale, float max_scale):
+    budget(budget_seconds), minScale(1.0f), maxScale(1.0f), scale(1.0f) {
+    setScaleBounds(min_scale, max_scale);
+    scale = maxScale;
+}
+
+void
+ResolutionController::setBudget(double budget_seconds) {
+    budget = budget_seconds;
+}
+
+/*
+    \brief Bounds of the scale per axis. Swapped bounds are put in order,
+           and bounds below MinScale, or NaN, are raised to it so that a
+           frame always has pixels.
+*/
+void
+ResolutionController::setScaleBounds(float min_scale, float max_scale) {
+    if (!(min_scale >= MinScale)) min_scale = MinScale;
+    if (!(max_scale >= MinScale)) max_scale = MinScale;
+    if (min_scale > max_scale) swap(min_scale, max_scale);
+    minScale = min_scale;
+    maxScale = max_scale;
+    scale = min(max(scale, minScale), maxScale);
+}
+
+/*
+    \brief Feed the time the last frame took.
+    \returns scale for the next frame
+*/
+float
+ResolutionController::update(double frame_seconds) {
+    if (frame_seconds <= 0) return scale;
+    /* aim 10% under the budget so that noise does not push frames over */
+    float wanted = scale * sqrtf((float)(budget * 0.9 / frame_seconds));
+    /* drop at once, climb back slowly */
+    if (wanted > scale) wanted = scale + (wanted - scale) * 0.25f;
+    wanted = min(max(wanted, minScale), maxScale);
+    /* small corrections only reallocate the target and flicker */
+    if (fabs(wanted - scale) > 0.05f * scale || wanted == minScale || wanted == maxScale)
+        scale = wanted;
+    return scale;
+}
+
+/*
+    \brief Pick a level from the projected size of the bounding sphere.
+           The level only changes once the size leaves a band of
+           `lod.hysteresis` around the switching point, to avoid popping.
+    \returns index into lod.levels
+*/
+unsigned
+RenderPipeline3D::selectLOD(MESH_LOD &lod) {
+    VEC3 d = lod.center - camera->position;
+    float dist = sqrt(d * d);
+    if (dist <= lod.radius) return lod.current = 0;
+    /* projected radius in pixels */
+    float r = lod.radius / (dist * tanf(camera->fovY / 2.0f)) * canvas->h / 2.0f;
+    float area = Math::Pi * r * r;
+
+    /* finest level not exceeding the wanted density, for a given area */
+    auto pick = [&](float a) {
+        for (unsigned i = 0; i < lod.levels.size(); ++i)
+            if (lod.faceCount[i] <= a * lod.trianglesPerPixel) return i;
+        return (unsigned)lod.levels.size() - 1;
+    };
+    unsigned fine = pick(area * (1.0f + lod.hysteresis));
+    unsigned coarse = pick(area * (1.0f - lod.hysteresis));
+    if (lod.current < fine) lod.current = fine;
+    else if (lod.current > coarse) lod.current = coarse;
+    return lod.current;
+}
+
+/*
+    \brief Render the level of a LOD chain suited to the current view.
+    \param lod: level of detail chain, see MeshSimplifier::buildLOD
+*/
+void
+RenderPipeline3D::render(MESH_LOD &lod) {
+    if (lod.levels.empty()) return;
+    render(lod.levels[selectLOD(lod)]);
+}
+
+}
@@ -0,0 +1,383 @@
+/*
+Copyright (c) 2018 Zhang Weijia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "RenderServer.h"
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* PNG straight into the shared memory */
+#define SVPNG_LINKAGE static
+#define SVPNG_OUTPUT unsigned char *out
+#define SVPNG_PUT(u) (*out++ = (unsigned char)(u))
+#include "svpng.inc"
+
+using namespace std;
+
+namespace pixpix {
+
+RenderServer::RenderServer(const SCENE *scene, unsigned worker_count):
+    scene(scene), workerCount(worker_count), shadowMapSize(0), shadowPCF(1), shadowBias(0.05f),
+    listenFd(-1), quit(false), shmCounter(0) {
+    if (workerCount == 0) workerCount = thread::hardware_concurrency();
+    if (workerCount == 0) workerCount = 1;
+    wakeFd[0] = wakeFd[1] = -1;
+}
+
+RenderServer::~RenderServer() {
+    stop();
+}
+
+/*
+    \brief Same as RenderPipeline3D::setShadow, call before start().
+*/
+void
+RenderServer::setShadow(unsigned map_size, unsigned pcf_radius, float bias) {
+    shadowMapSize = map_size;
+    shadowPCF = pcf_radius;
+    shadowBias = bias;
+}
+
+/*
+    \brief Listen on `socket_path`, replacing a stale socket file, and
+           start the dispatcher and the workers.
+    \returns false if the socket could not be set up
+*/
+bool
+RenderServer::start(const char *socket_path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) return false;
+    strcpy(addr.sun_path, socket_path);
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) return false;
+    unlink(socket_path);
+    if (bind(listenFd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenFd, 64) < 0 || pipe(wakeFd) < 0) {
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    path = socket_path;
+    fcntl(wakeFd[0], F_SETFL, O_NONBLOCK);
+
+    quit = false;
+    dispatcher = thread(&RenderServer::dispatch, this);
+    for (unsigned i = 0; i < workerCount; ++i) {
+        workers.push_back(thread([this]() {
+            WORKER w;
+            w.canvas = new CANVAS(1, 1);
+            w.pipe = new RenderPipeline3D(w.canvas, &w.camera);
+            w.pipe->setShadow(shadowMapSize, shadowPCF, shadowBias);
+            work(w);
+            delete w.pipe;
+            delete w.canvas;
+        }));
+    }
+    return true;
+}
+
+/*
+    \brief Finish the requests being rendered, drop the queued ones and
+           close every connection.
+*/
+void
+RenderServer::stop() {
+    if (listenFd < 0) return;
+    quit = true;
+    {
+        lock_guard<mutex> guard(lock);
+        jobs.clear();
+    }
+    ready.notify_all();
+    char c = 0;
+    if (write(wakeFd[1], &c, 1) < 0) { /* dispatcher also polls `quit` */ }
+    for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+    workers.clear();
+    dispatcher.join();
+
+    for (size_t i = 0; i < conns.size(); ++i) closeConnection(conns[i]);
+    conns.clear();
+    close(listenFd);
+    close(wakeFd[0]);
+    close(wakeFd[1]);
+    listenFd = wakeFd[0] = wakeFd[1] = -1;
+    unlink(path.c_str());
+}
+
+void
+RenderServer::closeConnection(CONNECTION *conn) {
+    close(conn->fd);
+    if (conn->frame != nullptr) munmap(conn->frame, conn->capacity);
+    close(conn->shmFd);
+    shm_unlink(conn->shmName);
+    delete conn;
+}
+
+/*
+    \brief Grow the shared memory of a connection to at least `size` bytes.
+           Only called by the worker owning the connection.
+*/
+bool
+RenderServer::reserve(CONNECTION *conn, size_t size) {
+    if (size <= conn->capacity) return true;
+    if (conn->frame != nullptr) munmap(conn->frame, conn->capacity);
+    conn->frame = nullptr;
+    conn->capacity = 0;
+    if (ftruncate(conn->shmFd, size) < 0) return false;
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, conn->shmFd, 0);
+    if (p == MAP_FAILED) return false;
+    conn->frame = (unsigned char *)p;
+    conn->capacity = size;
+    return true;
+}
+
+/*
+    \brief Read what has arrived of the pending request of a connection,
+           without blocking. A complete request is queued for the workers.
+    \returns false if the connection hung up or failed
+*/
+bool
+RenderServer::receive(CONNECTION *conn) {
+    ssize_t n = recv(conn->fd, (char *)&conn->pending + conn->received,
+                     sizeof(RENDER_REQUEST) - conn->received, 0);
+    if (n == 0) return false;
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    if (conn->received == 0) conn->started = chrono::steady_clock::now();
+    conn->received += n;
+    if (conn->received < sizeof(RENDER_REQUEST)) return true;
+
+    JOB job = {conn, conn->pending};
+    conn->received = 0;
+    conn->busy = true;
+    {
+        lock_guard<mutex> guard(lock);
+        jobs.push_back(job);
+    }
+    ready.notify_one();
+    return true;
+}
+
+/*
+    \brief Dispatcher thread. Polls the listening socket and every idle
+           connection; a connection with a request in flight is left out
+           until its worker has replied, so requests on one connection are
+           answered in order. Requests are assembled from whatever has
+           arrived, and a client stalling inside a request is dropped once
+           RENDER_REQUEST_TIMEOUT has passed.
+*/
+void
+RenderServer::dispatch() {
+    vector<pollfd> fds;
+    vector<CONNECTION *> polled;
+    while (!quit) {
+        fds.clear();
+        polled.clear();
+        fds.push_back((pollfd){listenFd, POLLIN, 0});
+        fds.push_back((pollfd){wakeFd[0], POLLIN, 0});
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        int timeout = -1;                   /* until the first deadline */
+        for (size_t i = 0; i < conns.size(); ++i) {
+            if (conns[i]->busy) continue;
+            fds.push_back((pollfd){conns[i]->fd, POLLIN, 0});
+            polled.push_back(conns[i]);
+            if (conns[i]->received == 0) continue;
+            long long left = RENDER_REQUEST_TIMEOUT -
+                chrono::duration_cast<chrono::milliseconds>(now - conns[i]->started).count();
+            left = max(left, 0LL) + 1;
+            if (timeout < 0 || left < timeout) timeout = (int)left;
+        }
+        if (poll(fds.data(), fds.size(), timeout) < 0) continue;
+        if (quit) break;
+
+        if (fds[1].revents) {
+            char buf[64];
+            while (read(wakeFd[0], buf, sizeof(buf)) > 0) {}
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd >= 0) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                CONNECTION *conn = new CONNECTION;
+                conn->fd = fd;
+                conn->frame = nullptr;
+                conn->capacity = 0;
+                conn->busy = false;
+                conn->received = 0;
+                snprintf(conn->shmName, sizeof(conn->shmName), "/pixpix-%d-%u", (int)getpid(), shmCounter++);
+                conn->shmFd = shm_open(conn->shmName, O_CREAT | O_EXCL | O_RDWR, 0600);
+                if (conn->shmFd < 0) {
+                    close(fd);
+                    delete conn;
+                } else {
+                    conns.push_back(conn);
+                }
+            }
+        }
+        now = chrono::steady_clock::now();
+        for (size_t i = 0; i < polled.size(); ++i) {
+            short ev = fds[i + 2].revents;
+            CONNECTION *conn = polled[i];
+            bool alive = ev == 0 || ((ev & POLLIN) && receive(conn));
+            /* stalled in the middle of a request */
+            if (alive && !conn->busy && conn->received > 0 &&
+                now - conn->started >= chrono::milliseconds(RENDER_REQUEST_TIMEOUT))
+                alive = false;
+            if (!alive) {
+                conns.erase(find(conns.begin(), conns.end(), conn));
+                closeConnection(conn);
+            }
+        }
+    }
+}
+
+/*
+    \brief Send all of `len` bytes on a non-blocking socket, waiting at most
+           RENDER_REQUEST_TIMEOUT for a client that does not read.
+*/
+static bool
+sendAll(int fd, const void *buf, size_t len) {
+    const char *p = (const char *)buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n > 0) {
+            p += n;
+            len -= n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            pollfd pfd = {fd, POLLOUT, 0};
+            if (poll(&pfd, 1, RENDER_REQUEST_TIMEOUT) <= 0) return false;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+    \brief Sizes, format and camera of a request are usable: magic and
+           format known, both sides in [1, RENDER_MAX_SIZE], camera finite
+           and fovY in (0, pi).
+*/
+static bool
+validRequest(const RENDER_REQUEST &req) {
+    if (req.magic != RENDER_REQUEST_MAGIC || req.format > F_PNG) return false;
+    if (req.width == 0 || req.height == 0 || req.width > RENDER_MAX_SIZE || req.height > RENDER_MAX_SIZE)
+        return false;
+    const float f[7] = {req.position.x, req.position.y, req.position.z,
+                        req.rotation.x, req.rotation.y, req.rotation.z, req.fovY};
+    for (int i = 0; i < 7; ++i)
+        if (!isfinite(f[i])) return false;
+    return req.fovY > 0.0f && req.fovY < Math::Pi;
+}
+
+/*
+    \brief Worker thread, renders jobs until stop().
+*/
+void
+RenderServer::work(WORKER &w) {
+    for (;;) {
+        JOB job;
+        {
+            unique_lock<mutex> guard(lock);
+            ready.wait(guard, [this]() { return quit || !jobs.empty(); });
+            if (quit) return;
+            job = jobs.front();
+            jobs.pop_front();
+        }
+        serve(w, job);
+        job.conn->busy = false;
+        char c = 0;
+        if (write(wakeFd[1], &c, 1) < 0) { /* pipe full, dispatcher wakes anyway */ }
+    }
+}
+
+/*
+    \brief Render one request into the connection's shared memory and
+           send the reply.
+*/
+void
+RenderServer::serve(WORKER &w, JOB &job) {
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    const RENDER_REQUEST &req = job.request;
+    RENDER_REPLY reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.magic = RENDER_REPLY_MAGIC;
+    reply.id = req.id;
+    reply.status = RS_OK;
+    strcpy(reply.shmName, job.conn->shmName);
+
+    if (!validRequest(req)) {
+        reply.status = RS_BAD_REQUEST;
+    } else {
+        size_t raw = (size_t)req.width * req.height * 3;
+        size_t size = req.format == F_PNG ? raw + req.height * 6 + 64 : raw;
+        if (!reserve(job.conn, size)) reply.status = RS_NO_MEMORY;
+    }
+
+    if (reply.status == RS_OK) {
+        if (w.canvas->w != req.width || w.canvas->h != req.height) {
+            delete w.canvas;
+            w.canvas = new CANVAS(req.width, req.height);
+            w.pipe->setCanvas(w.canvas);
+        }
+        w.camera.position = req.position;
+        w.camera.rotation = req.rotation;
+        w.camera.fovY = req.fovY;
+        w.camera.aspect_ratio = (float)req.width / req.height;
+
+        RenderPipeline3D &pipe = *w.pipe;
+        pipe.init();
+        for (size_t i = 0; i < scene->lights.size(); ++i) pipe.addLight(scene->lights[i]);
+        for (size_t i = 0; i < scene->casters.size(); ++i) pipe.addShadowCaster(scene->casters[i]);
+        for (size_t i = 0; i < scene->draws.size(); ++i) {
+            pipe.setTexture(scene->draws[i].texture);
+            pipe.setMaterial(scene->draws[i].material);
+            pipe.render(scene->draws[i].mesh);
+        }
+        pipe.flush();
+
+        if (req.format == F_PNG) {
+            svpng(job.conn->frame, req.width, req.height, w.canvas->img, 0);
+            reply.size = req.width * req.height * 3 + req.height * 6 + 63;
+        } else {
+            reply.size = req.width * req.height * 3;
+            memcpy(job.conn->frame, w.canvas->img, reply.size);
+        }
+    }
+    reply.seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    /* a client that went away or does not read is dropped by the
+       dispatcher */
+    if (!sendAll(job.conn->fd, &reply, sizeof(reply))) shutdown(job.conn->fd, SHUT_RDWR);
+}
+
+}
\ No newline at end of file
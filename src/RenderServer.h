@@ -0,0 +1,154 @@
+/*
+Copyright (c) 2018 Zhang Weijia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __RENDER_SERVER_H__
+#define __RENDER_SERVER_H__
+
+/* POSIX only: Unix domain sockets and shm_open */
+#include "pixpix.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <string>
+#include <chrono>
+
+namespace pixpix {
+
+/* wire format
+    a client connects to the server socket and sends RENDER_REQUESTs, one
+    at a time, each answered by a RENDER_REPLY. The frame itself is left at
+    the start of a shared memory object owned by the connection, named in
+    the reply; it stays valid until the next request on that connection.
+    Both ends share the machine, so everything is in host byte order.
+    A request must arrive whole within RENDER_REQUEST_TIMEOUT of its first
+    byte, otherwise the server drops the connection.
+    A request only chooses the view: size, format and camera. Meshes,
+    lights and materials are those of the SCENE the server was started
+    with and cannot be changed over the wire; to show a different scene,
+    start another server.
+*/
+const unsigned RENDER_REQUEST_MAGIC = 0x51525850;  /* "PXRQ" */
+const unsigned RENDER_REPLY_MAGIC = 0x50525850;    /* "PXRP" */
+const unsigned RENDER_MAX_SIZE = 4096;             /* per side, in pixels */
+const int RENDER_REQUEST_TIMEOUT = 2000;           /* milliseconds        */
+
+enum FRAME_FORMAT {
+    F_RGB24,            /* rows top first, 3 bytes per pixel */
+    F_PNG               /* uncompressed PNG                  */
+};
+
+enum RENDER_STATUS {
+    RS_OK,
+    RS_BAD_REQUEST,     /* wrong magic, size, format or camera */
+    RS_NO_MEMORY        /* shared memory could not grow */
+};
+
+struct RENDER_REQUEST {
+    unsigned magic;
+    unsigned id;                            /* echoed in the reply            */
+    unsigned width, height;
+    unsigned format;                        /* FRAME_FORMAT                   */
+    VEC3 position;                          /* camera, finite                 */
+    VEC3 rotation;
+    float fovY;                             /* in (0, pi)                     */
+};
+
+struct RENDER_REPLY {
+    unsigned magic;
+    unsigned id;
+    unsigned status;                        /* RENDER_STATUS                  */
+    unsigned size;                          /* frame bytes in shared memory   */
+    double seconds;                         /* render and encode on the server */
+    char shmName[32];                       /* shm_open name of the frame     */
+};
+
+static_assert(sizeof(RENDER_REQUEST) == 48, "RENDER_REQUEST is part of the protocol");
+static_assert(sizeof(RENDER_REPLY) == 56, "RENDER_REPLY is part of the protocol");
+
+/*
+    \brief Long running renderer for a resident SCENE. One dispatcher
+           thread accepts connections and reads requests, a pool of
+           workers renders them. Every worker keeps its pipeline, canvas
+           and shadow maps between requests, so a request only pays for
+           its own rendering and encoding.
+*/
+class RenderServer {
+private:
+    struct CONNECTION {
+        int fd;
+        int shmFd;
+        unsigned char *frame;               /* mapped shared memory           */
+        size_t capacity;
+        std::atomic<bool> busy;             /* a worker owns the connection   */
+        char shmName[32];
+        RENDER_REQUEST pending;             /* request being received         */
+        size_t received;                    /* bytes of `pending` so far      */
+        std::chrono::steady_clock::time_point started; /* first byte of `pending` */
+    };
+    struct JOB {
+        CONNECTION *conn;
+        RENDER_REQUEST request;
+    };
+    struct WORKER {
+        RenderPipeline3D *pipe;
+        CANVAS *canvas;
+        CAMERA camera;
+    };
+
+    const SCENE *scene;
+    unsigned workerCount;
+    unsigned shadowMapSize, shadowPCF;
+    float shadowBias;
+
+    std::string path;
+    int listenFd;
+    int wakeFd[2];                          /* workers wake the dispatcher    */
+    std::atomic<bool> quit;
+    std::thread dispatcher;
+    std::vector<std::thread> workers;
+    std::vector<CONNECTION *> conns;        /* dispatcher thread only         */
+    unsigned shmCounter;
+
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<JOB> jobs;
+
+    void dispatch();
+    bool receive(CONNECTION *);
+    void work(WORKER &);
+    void serve(WORKER &, JOB &);
+    bool reserve(CONNECTION *, size_t);
+    void closeConnection(CONNECTION *);
+public:
+    RenderServer(const SCENE *scene, unsigned worker_count = 0);
+    ~RenderServer();
+
+    void setShadow(unsigned map_size, unsigned pcf_radius = 1, float bias = 0.05f);
+    bool start(const char *socket_path);
+    void stop();
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,112 @@
+/*
+Copyright (c) 2018 Zhang Weijia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __FRAME_QUEUE_H__
+#define __FRAME_QUEUE_H__
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+namespace pixpix {
+
+/*
+    \brief Bounded lock-free ring for exactly one producer thread and one
+           consumer thread. One slot is kept empty to tell full from empty,
+           so it holds at most N - 1 items.
+*/
+template <typename T, unsigned N>
+class SPSCQueue {
+private:
+    T buf[N];
+    alignas(64) std::atomic<unsigned> head;     /* next slot to pop, consumer */
+    alignas(64) std::atomic<unsigned> tail;     /* next slot to push, producer */
+
+    /* spin briefly, then sleep so a stalled stage does not burn a core */
+    static void backoff(unsigned spin) {
+        if (spin < 64) std::this_thread::yield();
+        else std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+public:
+    SPSCQueue(): head(0), tail(0) {}
+
+    /* false when full */
+    bool push(const T &item) {
+        unsigned t = tail.load(std::memory_order_relaxed);
+        unsigned next = (t + 1) % N;
+        if (next == head.load(std::memory_order_acquire)) return false;
+        buf[t] = item;
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /* false when empty */
+    bool pop(T &item) {
+        unsigned h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        item = buf[h];
+        head.store((h + 1) % N, std::memory_order_release);
+        return true;
+    }
+
+    /* blocking variants, give up when `stop` is set */
+    bool push(const T &item, const std::atomic<bool> &stop) {
+        for (unsigned spin = 0; !push(item); ++spin) {
+            if (stop.load(std::memory_order_relaxed)) return false;
+            backoff(spin);
+        }
+        return true;
+    }
+
+    bool pop(T &item, const std::atomic<bool> &stop) {
+        for (unsigned spin = 0; !pop(item); ++spin) {
+            if (stop.load(std::memory_order_relaxed)) return false;
+            backoff(spin);
+        }
+        return true;
+    }
+};
+
+/*
+    \brief Fixed rate frame clock. wait() sleeps until the next tick; a
+           caller that fell more than one period behind is resynchronized
+           instead of rushing through the missed ticks.
+*/
+class FrameClock {
+private:
+    std::chrono::steady_clock::duration period;
+    std::chrono::steady_clock::time_point next;
+public:
+    FrameClock(unsigned fps): period(std::chrono::microseconds(1000000 / fps)),
+                              next(std::chrono::steady_clock::now()) {}
+
+    void wait() {
+        next += period;
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (next < now - period) next = now;
+        std::this_thread::sleep_until(next);
+    }
+};
+
+}
+
+#endif
@@ -22,10 +22,12 @@ SOFTWARE.
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <Windows.h>
 #include "cli_graph.h"
 #include "svpng.inc"
 #include "pixpix.h"
+#include "frame_queue.h"
 using namespace pixpix;
 using namespace std;
 
@@ -61,19 +63,20 @@ void drawPlane(RenderPipeline3D *pipeline, float w, float h, VEC3 position, VEC3
     mesh.verts = new vector<VEC3>(verts, verts+4);
 
     /* normal transformation */
-    for (size_t i = 0; i < 6; ++i) {
-        VEC4 v_tmp = (VEC4){(*mesh.normal)[i].x, (*mesh.normal)[i].y, (*mesh.normal)[i].z, 1.0f};
-        v_tmp = Math::matrixVecMul(m_rot, v_tmp);
-        v_tmp.regularize();
-        (*mesh.normal)[i] = v_tmp;
-    }
+    Math::transformNormals(m_comp, mesh.normal->data(), mesh.normal->data(), mesh.normal->size());
 
     pipeline->render(mesh);
 }
 
+/* scene state handed from the update stage to the render stage */
+struct FRAME_PARAMS {
+    VEC3 camPosition;
+};
+
 int main() {
     /* testcode */
     const int W = 128, H = 64;
+    const unsigned POOL = 3;
     CANVAS *cav = new CANVAS(W, H);
     CAMERA *cam = new CAMERA();
     RenderPipeline3D *pipeline = new RenderPipeline3D(cav, cam);
@@ -81,6 +84,7 @@ int main() {
     LIGHT *lgt = new LIGHT();
     MATERIAL *mat = new MATERIAL();
 
+    pipeline->setRetained(true);
     pipeline->init();
     cam->position = {0.0f, 0.0f, 4.0f};
     cam->lookAt(0, 0, 0);
@@ -100,29 +104,68 @@ int main() {
     lgt->mPosition = {0.0f, 5.0f, 0.0f};
 
     mat->specularSmoothLevel = 100;
-    for (int i = -30; ; ++i) {
-        if (i > 30) i = -30;
-        cam->position = {i / 10.0f, i / 10.0f, 4.0f};
-        cam->lookAt(0, 0, 0);
-        pipeline->init();
-        pipeline->setMaterial(mat);
-        //lgt->mPosition = {3.0f * cos(Math::Pi/60.0f*i), 3.0f, 3.0f * sin(Math::Pi/60.0f*i)};
-        lgt->mAmbientColor = {0.1f, 0.1f, 0.1f};
-        lgt->mSpecularColor = {1.0f, 1.0f, 1.0f};
-        lgt->mPosition = {1.0f, 5.0f, 0.0f};
-        pipeline->addLight(*lgt);
-        lgt->mAmbientColor = {0, 0, 0};
-        lgt->mSpecularColor = {1.0f, 1.0f, 0.0f};
-        lgt->mPosition = {-1.0f, -5.0f, 5.0f};
-        pipeline->addLight(*lgt);
-
-        tex->color1 = {1.0, 0.5, 0.5, 1.0};
-        tex->color2 = {0.1, 0.1, 0.1, 1.0};
-        pipeline->setTexture(tex);
-        drawPlane(pipeline, 3.0f, 3.0f, {0.0f,0.0f,0.0f}, {0, 0, 0});
-
-        cli_graph(W, H, cav->img);
-        Sleep(50);
+
+    /*  update --params--> render --ready--> present
+                             ^                  |
+                             +-----spare--------+
+        Every stage runs on its own thread. A stage blocks when its output
+        ring is full, so a slow stage throttles the ones before it. The
+        canvases cycle between `spare` and `ready`. */
+    SPSCQueue<FRAME_PARAMS, 4> params;
+    SPSCQueue<CANVAS *, POOL + 1> ready, spare;
+    std::atomic<bool> stop(false);
+    for (unsigned i = 0; i < POOL; ++i) spare.push(new CANVAS(W, H));
+
+    std::thread update([&]() {
+        for (int i = -30; ; ++i) {
+            if (i > 30) i = -30;
+            FRAME_PARAMS p;
+            p.camPosition = {i / 10.0f, i / 10.0f, 4.0f};
+            if (!params.push(p, stop)) return;
+        }
+    });
+
+    std::thread render([&]() {
+        FRAME_PARAMS p;
+        CANVAS *out;
+        while (params.pop(p, stop) && spare.pop(out, stop)) {
+            cam->position = p.camPosition;
+            cam->lookAt(0, 0, 0);
+            pipeline->init();
+            pipeline->setMaterial(mat);
+            //lgt->mPosition = {3.0f * cos(Math::Pi/60.0f*i), 3.0f, 3.0f * sin(Math::Pi/60.0f*i)};
+            lgt->mAmbientColor = {0.1f, 0.1f, 0.1f};
+            lgt->mSpecularColor = {1.0f, 1.0f, 1.0f};
+            lgt->mPosition = {1.0f, 5.0f, 0.0f};
+            pipeline->addLight(*lgt);
+            lgt->mAmbientColor = {0, 0, 0};
+            lgt->mSpecularColor = {1.0f, 1.0f, 0.0f};
+            lgt->mPosition = {-1.0f, -5.0f, 5.0f};
+            pipeline->addLight(*lgt);
+
+            tex->color1 = {1.0, 0.5, 0.5, 1.0};
+            tex->color2 = {0.1, 0.1, 0.1, 1.0};
+            pipeline->setTexture(tex);
+            drawPlane(pipeline, 3.0f, 3.0f, {0.0f,0.0f,0.0f}, {0, 0, 0});
+            pipeline->flush();
+
+            /* the pipeline keeps drawing into `cav` so that retained mode
+               can patch it, hand a copy downstream */
+            memcpy(out->img, cav->img, W * H * 3);
+            if (!ready.push(out, stop)) return;
+        }
+    });
+
+    /* present on the main thread, paced at 20 frames per second */
+    FrameClock clock(20);
+    CANVAS *frame;
+    while (ready.pop(frame, stop)) {
+        cli_graph(W, H, frame->img);
+        spare.push(frame);
+        clock.wait();
     }
+    stop = true;
+    update.join();
+    render.join();
     return 0;
-}
\ No newline at end of file
+}
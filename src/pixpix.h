@@ -26,6 +26,9 @@ SOFTWARE.
 #include <cmath>
 #include <vector>
 #include <cstdio>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 using namespace std;
 
 namespace pixpix {
@@ -84,21 +87,31 @@ struct VEC3 {
     }
 };
 
-/* vector 4d */
+/* vector 4d, one SSE register
+    left unaligned so vertex and fragment structs keep their size */
 struct VEC4 {
     float x, y, z, w;
-    VEC4 operator + (VEC4 rhs) const { return (VEC4){x+rhs.x,y+rhs.y,z+rhs.z,w+rhs.w}; }
-    VEC4 operator - (VEC4 rhs) const { return (VEC4){x-rhs.x,y-rhs.y,z-rhs.z,w-rhs.w}; }
+#ifdef __SSE__
+    static VEC4 fromSSE(__m128 v) { VEC4 r; _mm_storeu_ps(&r.x, v); return r; }
+    __m128 sse() const { return _mm_loadu_ps(&x); }
+    VEC4 operator + (const VEC4 &rhs) const { return fromSSE(_mm_add_ps(sse(), rhs.sse())); }
+    VEC4 operator - (const VEC4 &rhs) const { return fromSSE(_mm_sub_ps(sse(), rhs.sse())); }
+    VEC4 operator * (float rhs) const { return fromSSE(_mm_mul_ps(sse(), _mm_set1_ps(rhs))); }
+    VEC4 operator / (float rhs) const { return fromSSE(_mm_div_ps(sse(), _mm_set1_ps(rhs))); }
+#else
+    VEC4 operator + (const VEC4 &rhs) const { return (VEC4){x+rhs.x,y+rhs.y,z+rhs.z,w+rhs.w}; }
+    VEC4 operator - (const VEC4 &rhs) const { return (VEC4){x-rhs.x,y-rhs.y,z-rhs.z,w-rhs.w}; }
     VEC4 operator * (float rhs) const { return (VEC4){x*rhs,y*rhs,z*rhs,w*rhs}; }
     VEC4 operator / (float rhs) const { return (VEC4){x/rhs,y/rhs,z/rhs,w/rhs}; }
+#endif
     float getx() { return x / w; }
     float gety() { return y / w; }
     float getz() { return z / w; }
     void regularize() { x /= w, y /= w, z /= w; w = 1.0; }
 };
 
-/* matrix 4x4 */
-struct MATRIX4 {
+/* matrix 4x4, row major */
+struct alignas(32) MATRIX4 {
     float mat[4][4];
     void setRow(unsigned row, float a, float b, float c, float d) {
         mat[row][0] = a; mat[row][1] = b; mat[row][2] = c; mat[row][3] = d;
@@ -118,8 +131,12 @@ public:
     static MATRIX4 rotationZ(float angle);
     static MATRIX4 pitch_yaw_roll(float pitch, float yaw, float roll);
     static MATRIX4 projection(float fovY, float aspect_ratio, float nearZ, float farZ);
-    static MATRIX4 matrixMul(MATRIX4, MATRIX4);
-    static VEC4 matrixVecMul(MATRIX4, VEC4);
+    static MATRIX4 orthographic(float width, float height);
+    static MATRIX4 affineInverse(const MATRIX4 &);
+    static MATRIX4 matrixMul(const MATRIX4 &, const MATRIX4 &);
+    static VEC4 matrixVecMul(const MATRIX4 &, const VEC4 &);
+    static void transformPoints(const MATRIX4 &, const VEC3 *in, VEC4 *out, size_t n);
+    static void transformNormals(const MATRIX4 &, const VEC3 *in, VEC3 *out, size_t n);
 };
 
 /* color */
@@ -150,6 +167,23 @@ struct RASTERIZED_FRAGMENT {
     VEC3 normal;
 };
 
+struct MESH;
+
+/* quantization of render data
+    the batch decoders use SSE2 when available */
+class Packing {
+public:
+    static unsigned packColor(COLOR4);
+    static COLOR4 unpackColor(unsigned);
+    static void packTexCoord(VEC2, short out[2]);
+    static VEC2 unpackTexCoord(const short in[2]);
+    static void packNormal(VEC3, short out[2]);
+    static VEC3 unpackNormal(const short in[2]);
+    static void unpackTexCoords(const short *in, VEC2 *out, size_t n);
+    static void unpackNormals(const short *in, VEC3 *out, size_t n);
+    static MESH packMesh(MESH);
+};
+
 /* Canvas contains width, height and buffer using 8bit depth color */
 struct CANVAS {
     unsigned w, h;
@@ -158,7 +192,7 @@ struct CANVAS {
         img = new unsigned char[w * h * 3];
         clear();
     };
-    ~CANVAS() { delete img; }
+    ~CANVAS() { delete[] img; }
     void clear() {
         for (int i = 0; i < w * h * 3; ++i) img[i] = 0;
     }
@@ -168,6 +202,18 @@ struct CANVAS {
         img[p+1] = color.y * 255;
         img[p+2] = color.z * 255;
     };
+    COLOR4 getPixel(unsigned x, unsigned y) const {
+        unsigned p = (x + y * w) * 3;
+        return (COLOR4){img[p] / 255.0f, img[p+1] / 255.0f, img[p+2] / 255.0f, 1.0f};
+    };
+    /* source over, color.w is the coverage of `color` */
+    void blendPixel(unsigned x, unsigned y, COLOR4 color) {
+        COLOR4 dst = getPixel(x, y);
+        float a = color.w;
+        setPixel(x, y, (COLOR4){color.x * a + dst.x * (1 - a),
+                                color.y * a + dst.y * (1 - a),
+                                color.z * a + dst.z * (1 - a), 1.0f});
+    };
 };
 
 /* ADTs, render data structures */
@@ -228,28 +274,58 @@ struct MATERIAL {
     COLOR3 diffuse;
     COLOR3 specular;
     unsigned specularSmoothLevel;
-    MATERIAL (): ambient( {0,0,0} ), diffuse( {1.0f, 0, 0} ), specular( {1.0f, 1.0f, 1.0f }), specularSmoothLevel(10) {}
+    float opacity;                  /* 1 opaque, below 1 blended */
+    MATERIAL (): ambient( {0,0,0} ), diffuse( {1.0f, 0, 0} ), specular( {1.0f, 1.0f, 1.0f }), specularSmoothLevel(10),
+                 opacity(1.0f) {}
 };
 
 /* light */
+enum LIGHT_TYPE {
+    L_POINT,            /* shines from mPosition in every direction */
+    L_DIRECTIONAL       /* parallel rays travelling along mDirection */
+};
+
 struct LIGHT {
+    LIGHT_TYPE mType;
     COLOR3 mAmbientColor;
     COLOR3 mDiffuseColor;
     COLOR3 mSpecularColor;
     VEC3  mPosition;
+    VEC3  mDirection;
     float mSpecularIntensity;
     float mDiffuseIntensity;
     bool mIsEnabled;
-    Light() {
+    bool mCastShadow;
+    LIGHT(): mType(L_POINT), mAmbientColor({0, 0, 0}), mDiffuseColor({1.0f, 1.0f, 1.0f}),
+             mSpecularColor({1.0f, 1.0f, 1.0f}), mPosition({0, 0, 0}), mDirection({0, -1.0f, 0}) {
         mSpecularIntensity = 1.0f;
         mDiffuseIntensity = 0.5f;
         mIsEnabled = true;
+        mCastShadow = false;
     }
 };
 
+/* shadow map
+    depth seen from a light, 6 cube faces for point lights and a single
+    orthographic face for directional lights. `key` hashes the light and the
+    casters the map was rendered from, an unchanged key skips re-rendering.
+*/
+struct SHADOW_MAP {
+    unsigned size;                          /* texels per edge                */
+    unsigned faces;                         /* 6 for point, 1 for directional */
+    bool perspective;                       /* depth is 1/w interpolated      */
+    MATRIX4 viewProj[6];                    /* world -> light clip space      */
+    vector<float> depth;                    /* faces * size * size texels     */
+    unsigned long long key;
+
+    SHADOW_MAP(): size(0), faces(0), perspective(true), key(0) {}
+};
+
 /* mesh 
     contains a vertex list and a triangle list using index referring to 
-    the vertexs.
+    the vertexs. Normals and texture coordinates are either float or, in a
+    mesh made by Packing::packMesh, quantized (normal and texCoord are then
+    nullptr). Copies are shallow and share the vectors.
 */
 struct MESH {
     vector<VEC3> *verts;                    /* vertex list                    */
@@ -257,15 +333,145 @@ struct MESH {
     vector<unsigned> *vertexIndex;          /* vertex index in the list above */
     vector<VEC3> *normal;                   /* vertex normal                  */
     vector<VEC2> *texCoord;                 /* vertex texture coordinates     */
+    vector<short> *normalPacked;            /* octahedral normal, 2 per corner */
+    vector<short> *texCoordPacked;          /* 4.12 tex coord, 2 per corner   */
 
     MESH(): verts(nullptr), faceIndex(nullptr), vertexIndex(nullptr), 
-            normal(nullptr), texCoord(nullptr) {}
+            normal(nullptr), texCoord(nullptr),
+            normalPacked(nullptr), texCoordPacked(nullptr) {}
+};
+
+/* level of detail chain
+    levels[0] is the original mesh, every following level is a simplified
+    copy with fewer triangles. `current` keeps the level picked in the last
+    frame so that the selection can apply hysteresis.
+*/
+struct MESH_LOD {
+    vector<MESH> levels;                    /* meshes, finest first           */
+    vector<unsigned> faceCount;             /* triangles per level            */
+    VEC3 center;                            /* bounding sphere center         */
+    float radius;                           /* bounding sphere radius         */
+    float trianglesPerPixel;                /* wanted density on screen       */
+    float hysteresis;                       /* relative size band, no switch  */
+    unsigned current;                       /* level chosen in last frame     */
+
+    MESH_LOD(): center({0, 0, 0}), radius(0), trianglesPerPixel(0.5f),
+                hysteresis(0.2f), current(0) {}
+};
+
+/* mesh simplification
+    quadric error metric edge collapse (Garland & Heckbert). Per-corner
+    normals and texture coordinates are carried over from the surviving
+    corners.
+*/
+class MeshSimplifier {
+public:
+    static MESH simplify(MESH mesh, unsigned target_faces);
+    static MESH_LOD buildLOD(MESH mesh, unsigned max_levels = 6,
+                             unsigned min_faces = 16, float ratio = 0.5f);
+};
+
+/* procedural primitives
+    generators return indexed triangle meshes. Vertex positions are shared
+    between faces, normals and texture coordinates are stored per corner.
+    The triangle order is vertex cache optimized.
+*/
+class Geometry {
+public:
+    static MESH cube(float size, unsigned tess = 1);
+    static MESH sphere(float radius, unsigned slices = 16, unsigned stacks = 8);
+    static MESH cylinder(float radius, float height, unsigned slices = 16, unsigned stacks = 1);
+    static MESH teapot(float size, unsigned tess = 6);
+    static void optimizeVertexCache(MESH &mesh, unsigned cache_size = 32);
+    static float getACMR(MESH mesh, unsigned cache_size = 32);
 };
 
 /* ============================================ */
 /*        Renderer, render pipelines            */
 /* ============================================ */
 
+/* pixel rectangle, both corners inclusive, empty when x0 > x1 or y0 > y1 */
+struct SCREEN_RECT {
+    int x0, y0, x1, y1;
+    bool empty() const { return x0 > x1 || y0 > y1; }
+    SCREEN_RECT intersect(SCREEN_RECT rhs) const {
+        return (SCREEN_RECT){x0>rhs.x0?x0:rhs.x0, y0>rhs.y0?y0:rhs.y0,
+                             x1<rhs.x1?x1:rhs.x1, y1<rhs.y1?y1:rhs.y1};
+    }
+    SCREEN_RECT merge(SCREEN_RECT rhs) const {
+        if (empty()) return rhs;
+        if (rhs.empty()) return *this;
+        return (SCREEN_RECT){x0<rhs.x0?x0:rhs.x0, y0<rhs.y0?y0:rhs.y0,
+                             x1>rhs.x1?x1:rhs.x1, y1>rhs.y1?y1:rhs.y1};
+    }
+    int area() const { return empty() ? 0 : (x1 - x0 + 1) * (y1 - y0 + 1); }
+};
+
+/* draw call, a mesh with the texture and material bound when issued */
+struct DRAW_CALL {
+    MESH mesh;
+    TEXTURE *texture;
+    MATERIAL *material;
+};
+
+/* transparent fragment waiting for the resolve at the end of the frame */
+struct OIT_FRAGMENT {
+    float depth;
+    unsigned color;                         /* RGBA8, Packing::packColor      */
+};
+
+/* what a retained draw call looked like in the previous frame */
+struct DRAW_RECORD {
+    unsigned long long key;                 /* hash of mesh, texture, material */
+    SCREEN_RECT bounds;                     /* pixels it may have touched     */
+};
+
+/* everything drawn in a frame, independent of the viewer */
+struct SCENE {
+    vector<DRAW_CALL> draws;
+    vector<LIGHT> lights;
+    vector<MESH> casters;                   /* shadow casters                 */
+};
+
+/* a camera and the canvas it renders into */
+struct VIEW {
+    CAMERA *camera;
+    CANVAS *canvas;
+};
+
+/* timing of one MultiViewRenderer::render() */
+struct MULTI_VIEW_STATS {
+    unsigned views;
+    unsigned threads;
+    double seconds;                         /* wall time, shared work included */
+    double viewsPerSecondPerCore;
+};
+
+/*
+    \brief Picks the render scale for the next frame from the measured
+           frame time, so that frames stay under `budget` seconds. The cost
+           of a frame is taken as proportional to its pixel count, that is
+           to scale * scale.
+*/
+class ResolutionController {
+private:
+    double budget;                          /* seconds per frame              */
+    float minScale, maxScale;               /* bounds of the scale per axis   */
+    float scale;                            /* scale of the next frame        */
+public:
+    static constexpr float MinScale = 1.0f / 64;  /* smallest bound accepted  */
+
+    ResolutionController(double budget_seconds, float min_scale = 0.25f, float max_scale = 1.0f);
+
+    void setBudget(double budget_seconds);
+    double getBudget() const { return budget; }
+    void setScaleBounds(float min_scale, float max_scale);
+    float getMinScale() const { return minScale; }
+    float getMaxScale() const { return maxScale; }
+    float getScale() const { return scale; }
+    float update(double frame_seconds);
+};
+
 /*
     \brief class RenderPipeline3D handles vertex light & color calc, 
            texture & material render, per pixel lighting.
@@ -274,31 +480,105 @@ class RenderPipeline3D {
 private:
     // vector<VERTEX_RENDER> *vertex_homo;     /* homogeneous vertexes */
     // vector<VERTEX_RENDER> *vertex_homo_clipped;
-    vector<RASTERIZED_FRAGMENT> *fragment;  /* rasterized fragment  */
-    vector<float> *zBuffer;                 /* z - buffer           */
+    vector<float> *zBuffer;                 /* z - buffer, per pixel */
     vector<LIGHT> *light;                   /* lights               */
     CAMERA *camera;                         /* camera               */
     CANVAS *canvas;                         /* pixel - buffer       */
+    CANVAS *output;                         /* canvas given by the user */
+    CANVAS *target;                         /* scaled render target */
+    ResolutionController *resolution;       /* nullptr, render at output size */
+    double frameStart;                      /* seconds, set by init() */
 
     TEXTURE *texture;
     MATERIAL *material;
+
+    vector<MESH> *caster;                   /* shadow casters of the frame    */
+    vector<SHADOW_MAP> *shadowMap;          /* one per light, kept as cache   */
+    unsigned shadowMapSize;                 /* 0 disables shadows             */
+    unsigned shadowPCF;                     /* PCF kernel radius in texels    */
+    float shadowBias;
+    bool shadowReady;
+
+    bool retained;                          /* defer draws to flush()         */
+    vector<DRAW_CALL> *draws;               /* draws of the current frame     */
+    vector<DRAW_RECORD> *history;           /* draws of the previous frame    */
+    unsigned long long frameKey;            /* camera, lights, canvas         */
+    SCREEN_RECT scissor;                    /* pixels rasterization may touch */
+
+    static const unsigned OIT_LAYERS = 4;   /* k-buffer depth                 */
+    vector<OIT_FRAGMENT> *oitBuffer;        /* OIT_LAYERS per pixel, nearest first */
+    vector<unsigned char> *oitCount;        /* fragments used per pixel       */
     
     COLOR4 getChessBoard(VEC2, unsigned, COLOR4, COLOR4);
     void bilinearInterpolation(VEC2, VEC2, VEC2, VEC2, float &, float &);
     bool zBufferTest(RASTERIZED_FRAGMENT, float);
     void shadeFragment(RASTERIZED_FRAGMENT &, VEC3);
     void renderTriangle(vector<VEC3> *verts, vector<VEC4> *verts_homo, vector<VEC3> *normal, vector<VEC2> *tex_coord, vector<unsigned> *tri_verts);
+    void storeFragment(RASTERIZED_FRAGMENT &, VEC3 pos_origin, float depth);
+    bool getTriangleRect(VEC4 v_homo[3], SCREEN_RECT &);
+    SCREEN_RECT getMeshRect(MESH, vector<VEC4> *verts_homo);
+    void drawMesh(MESH, vector<VEC4> *verts_homo);
+    void clearRect(SCREEN_RECT);
+    unsigned long long getFrameKey();
     vector<VEC4> *getVertexClipSpace(vector<VEC3> *);
+    void updateShadowMaps();
+    void renderDepth(SHADOW_MAP &, unsigned face, MESH);
+    unsigned selectLOD(MESH_LOD &);
+    void insertTransparent(unsigned x, unsigned y, float depth, COLOR4);
+    void resolveTransparent(SCREEN_RECT);
+    void flushRetained();
+
 public:
-    RenderPipeline3D(CANVAS *cav, CAMERA *cam):camera(cam), canvas(cav), fragment(nullptr), zBuffer(nullptr), light(nullptr) {}
+    RenderPipeline3D(CANVAS *cav, CAMERA *cam):zBuffer(nullptr), light(nullptr), camera(cam), canvas(cav),
+                     output(cav), target(nullptr), resolution(nullptr), frameStart(0),
+                     caster(nullptr), shadowMap(nullptr), shadowMapSize(0), shadowPCF(1), shadowBias(0.05f), shadowReady(false),
+                     retained(false), draws(nullptr), history(nullptr), frameKey(0),
+                     oitBuffer(nullptr), oitCount(nullptr) {}
     
     void init();
+    void setCanvas(CANVAS *);
+    void setCamera(CAMERA *);
+    MATRIX4 getViewMatrix(VEC3 position, VEC3 rotation);
     void setTexture(TEXTURE *);
     void setMaterial(MATERIAL *);
     void addLight(LIGHT);
+    void setShadow(unsigned map_size, unsigned pcf_radius = 1, float bias = 0.05f);
+    void addShadowCaster(MESH);
+    vector<SHADOW_MAP> *prepareShadowMaps();
+    float shadowFactor(unsigned light_idx, VEC3 pos);
+    void shareShadowMaps(vector<SHADOW_MAP> *);
     void render(MESH);
+    void render(MESH_LOD &);
+    void setRetained(bool);
+    void setDynamicResolution(ResolutionController *);
+    void flush();
+};
+
+/*
+    \brief Renders one SCENE from many VIEWs. Viewer independent work is
+           done once per call: shadow maps, unpacking of quantized
+           attributes and mesh bounding spheres. Views are then handed out
+           to worker threads, each owning a pipeline and its z-buffer.
+*/
+class MultiViewRenderer {
+private:
+    vector<RenderPipeline3D *> pipes;       /* one per worker thread          */
+    unsigned threads;
+    unsigned shadowMapSize, shadowPCF;
+    float shadowBias;
+
+    struct BOUNDS { VEC3 center; float radius; };
+    bool isVisible(BOUNDS, const MATRIX4 &view, const CAMERA &);
+    void renderView(RenderPipeline3D *, VIEW, const SCENE &, vector<SHADOW_MAP> *shadow_maps,
+                    const vector<MESH> &meshes, const vector<BOUNDS> &);
+public:
+    MultiViewRenderer(unsigned thread_count = 0);
+    ~MultiViewRenderer();
+
+    void setShadow(unsigned map_size, unsigned pcf_radius = 1, float bias = 0.05f);
+    MULTI_VIEW_STATS render(const SCENE &, const vector<VIEW> &);
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -0,0 +1,94 @@
+/*
+Copyright (c) 2018 Zhang Weijia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* resident render daemon, see RenderServer.h for the protocol
+    usage: server [socket path] [workers]
+*/
+#include <cstdio>
+#include <cstdlib>
+#include <csignal>
+#include "pixpix.h"
+#include "RenderServer.h"
+
+using namespace pixpix;
+
+static MESH
+moved(MESH mesh, VEC3 scale, VEC3 offset) {
+    for (size_t i = 0; i < mesh.verts->size(); ++i) {
+        VEC3 &v = (*mesh.verts)[i];
+        v = (VEC3){v.x * scale.x + offset.x, v.y * scale.y + offset.y, v.z * scale.z + offset.z};
+    }
+    return mesh;
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "/tmp/pixpix.sock";
+    unsigned worker_count = argc > 2 ? atoi(argv[2]) : 0;
+
+    /* the scene stays resident for the lifetime of the server */
+    TEXTURE *tex = new TEXTURE();
+    tex->ty = T_CHESS_BOARD;
+    tex->sz = 8;
+    tex->color1 = {1.0, 0.5, 0.5, 1.0};
+    tex->color2 = {0.1, 0.1, 0.1, 1.0};
+    MATERIAL *mat = new MATERIAL();
+    mat->specularSmoothLevel = 50;
+
+    LIGHT lgt;
+    lgt.mPosition = {1.0f, 5.0f, 1.0f};
+    lgt.mAmbientColor = {0.1f, 0.1f, 0.1f};
+    lgt.mDiffuseIntensity = 0.8f;
+    lgt.mCastShadow = true;
+
+    MESH floor = moved(Geometry::cube(1.0f, 4), (VEC3){8, 0.1f, 8}, (VEC3){0, -0.05f, 0});
+    MESH teapot = Geometry::teapot(1.5f);
+    MESH packed = Packing::packMesh(teapot);
+    /* the float streams are not used by anything else */
+    delete teapot.normal;
+    delete teapot.texCoord;
+    teapot = packed;
+
+    SCENE scene;
+    scene.lights.push_back(lgt);
+    scene.casters.push_back(teapot);
+    scene.draws.push_back((DRAW_CALL){floor, tex, mat});
+    scene.draws.push_back((DRAW_CALL){teapot, tex, mat});
+
+    /* signals are taken synchronously below, not by the server threads */
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+
+    RenderServer server(&scene, worker_count);
+    server.setShadow(512);
+    if (!server.start(path)) {
+        fprintf(stderr, "cannot listen on %s\n", path);
+        return 1;
+    }
+    printf("listening on %s\n", path);
+    int sig;
+    sigwait(&sigs, &sig);
+    server.stop();
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,248 @@
+/*
+Copyright (c) 2018 Zhang Weijia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* SIMD Math against the plain scalar code it replaced, timing and agreement.
+   Build with -O3 -march=native to take the AVX path of transformPoints. */
+#include <chrono>
+#include <cstdlib>
+#include "test.h"
+
+using namespace pixpix;
+
+/* the scalar code before vectorization, kept out of line like Math */
+__attribute__((noinline)) static VEC4
+scalarMatrixVecMul(const MATRIX4 &mat, const VEC4 &vec) {
+    VEC4 res;
+    res.x = mat.mat[0][0] * vec.x + mat.mat[0][1] * vec.y + mat.mat[0][2] * vec.z + mat.mat[0][3] * vec.w;
+    res.y = mat.mat[1][0] * vec.x + mat.mat[1][1] * vec.y + mat.mat[1][2] * vec.z + mat.mat[1][3] * vec.w;
+    res.z = mat.mat[2][0] * vec.x + mat.mat[2][1] * vec.y + mat.mat[2][2] * vec.z + mat.mat[2][3] * vec.w;
+    res.w = mat.mat[3][0] * vec.x + mat.mat[3][1] * vec.y + mat.mat[3][2] * vec.z + mat.mat[3][3] * vec.w;
+    return res;
+}
+
+__attribute__((noinline)) static MATRIX4
+scalarMatrixMul(const MATRIX4 &mat1, const MATRIX4 &mat2) {
+    MATRIX4 mat;
+    for (int i = 0; i < 4; ++i)
+        for (int j = 0; j < 4; ++j)
+            mat.mat[i][j] = mat1.mat[i][0] * mat2.mat[0][j] + mat1.mat[i][1] * mat2.mat[1][j] +
+                            mat1.mat[i][2] * mat2.mat[2][j] + mat1.mat[i][3] * mat2.mat[3][j];
+    return mat;
+}
+
+static float
+randf(float lo, float hi) {
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+static MATRIX4
+randomMatrix() {
+    MATRIX4 m;
+    for (int i = 0; i < 4; ++i)
+        for (int j = 0; j < 4; ++j) m.mat[i][j] = randf(-2, 2);
+    return m;
+}
+
+static float
+vecDiff(const VEC4 &a, const VEC4 &b) {
+    return fmax(fmax(fabs(a.x - b.x), fabs(a.y - b.y)), fmax(fabs(a.z - b.z), fabs(a.w - b.w)));
+}
+
+/* nanoseconds per call of f(i), i in [0, n) */
+template <class F> static double
+timeLoop(size_t n, F f) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i) f(i);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / n;
+}
+
+static volatile float sink;
+
+static void
+benchMatrixMul() {
+    const size_t n = 1 << 12, rounds = 1 << 8;
+    std::vector<MATRIX4> a(n), b(n), out(n);
+    for (size_t i = 0; i < n; ++i) a[i] = randomMatrix(), b[i] = randomMatrix();
+    float err = 0;
+    for (size_t i = 0; i < n; ++i) {
+        MATRIX4 s = scalarMatrixMul(a[i], b[i]), v = Math::matrixMul(a[i], b[i]);
+        for (int r = 0; r < 4; ++r)
+            for (int c = 0; c < 4; ++c) err = fmax(err, fabs(s.mat[r][c] - v.mat[r][c]));
+    }
+    double ts = timeLoop(n * rounds, [&](size_t i) { out[i % n] = scalarMatrixMul(a[i % n], b[(i + 1) % n]); });
+    sink = out[7].mat[1][2];
+    double tv = timeLoop(n * rounds, [&](size_t i) { out[i % n] = Math::matrixMul(a[i % n], b[(i + 1) % n]); });
+    sink = out[7].mat[1][2];
+    printf("matrixMul        ref %6.2f ns  Math %6.2f ns  x%.2f  max diff %g\n", ts, tv, ts / tv, err);
+    CHECK(err < 1e-5f);
+}
+
+static void
+benchMatrixVecMul() {
+    const size_t n = 1 << 14, rounds = 1 << 8;
+    MATRIX4 m = randomMatrix();
+    std::vector<VEC4> in(n), out(n);
+    for (size_t i = 0; i < n; ++i) in[i] = (VEC4){randf(-5, 5), randf(-5, 5), randf(-5, 5), 1.0f};
+    float err = 0;
+    for (size_t i = 0; i < n; ++i)
+        err = fmax(err, vecDiff(scalarMatrixVecMul(m, in[i]), Math::matrixVecMul(m, in[i])));
+    double ts = timeLoop(n * rounds, [&](size_t i) { out[i % n] = scalarMatrixVecMul(m, in[i % n]); });
+    sink = out[7].x;
+    double tv = timeLoop(n * rounds, [&](size_t i) { out[i % n] = Math::matrixVecMul(m, in[i % n]); });
+    sink = out[7].x;
+    printf("matrixVecMul     ref %6.2f ns  Math %6.2f ns  x%.2f  max diff %g\n", ts, tv, ts / tv, err);
+    CHECK(err < 1e-5f);
+}
+
+/* clip space transform of a vertex array, per vertex view then projection
+   as getVertexClipSpace did, against one folded transformPoints batch */
+static void
+benchClipSpace() {
+    const size_t n = 1 << 16, rounds = 1 << 6;
+    CAMERA camera;
+    camera.position = (VEC3){0, 3, 6};
+    camera.lookAt(0, 0, 0);
+    MATRIX4 view = Math::matrixMul(Math::pitch_yaw_roll(-camera.rotation.x, -camera.rotation.y, -camera.rotation.z),
+                                   Math::translation(-camera.position.x, -camera.position.y, -camera.position.z));
+    MATRIX4 proj = Math::projection(Math::Pi / 3, 4.0f / 3, 0.1f, 100.0f);
+    std::vector<VEC3> in(n);
+    std::vector<VEC4> ref(n), out(n);
+    for (size_t i = 0; i < n; ++i) in[i] = (VEC3){randf(-3, 3), randf(-3, 3), randf(-3, 3)};
+
+    double ts = 0, tv = 0;
+    for (size_t r = 0; r < rounds; ++r) {
+        ts += timeLoop(n, [&](size_t i) {
+            VEC4 v = scalarMatrixVecMul(view, (VEC4){in[i].x, in[i].y, in[i].z, 1.0f});
+            ref[i] = scalarMatrixVecMul(proj, v);
+        });
+        tv += timeLoop(1, [&](size_t) { Math::transformPoints(Math::matrixMul(proj, view), in.data(), out.data(), n); }) / n;
+    }
+    sink = ref[7].x + out[7].x;
+    float err = 0;
+    for (size_t i = 0; i < n; ++i) err = fmax(err, vecDiff(ref[i], out[i]) / fmax(1.0f, fabs(ref[i].w)));
+    printf("clip space / vtx ref %6.2f ns  Math %6.2f ns  x%.2f  max rel diff %g\n",
+           ts / rounds, tv / rounds, ts / tv, err);
+    CHECK(err < 1e-5f);
+}
+
+static float
+matDiff(const MATRIX4 &a, const MATRIX4 &b) {
+    float err = 0;
+    for (int i = 0; i < 4; ++i)
+        for (int j = 0; j < 4; ++j) err = fmax(err, fabs(a.mat[i][j] - b.mat[i][j]));
+    return err;
+}
+
+/* translation * rotation * scale, the matrices affineInverse is made for */
+static MATRIX4
+randomAffine() {
+    MATRIX4 s = Math::translation(0, 0, 0);
+    s.mat[0][0] = randf(0.5f, 2); s.mat[1][1] = randf(0.5f, 2); s.mat[2][2] = randf(0.5f, 2);
+    MATRIX4 r = Math::pitch_yaw_roll(randf(-3, 3), randf(-3, 3), randf(-3, 3));
+    return Math::matrixMul(Math::translation(randf(-5, 5), randf(-5, 5), randf(-5, 5)), Math::matrixMul(r, s));
+}
+
+/* closed form pitch_yaw_roll and affineInverse against their definitions */
+static void
+checkMatrices() {
+    float err_pyr = 0, err_inv = 0;
+    MATRIX4 id = Math::translation(0, 0, 0);
+    for (int i = 0; i < 10000; ++i) {
+        float p = randf(-4, 4), y = randf(-4, 4), r = randf(-4, 4);
+        MATRIX4 ref = Math::matrixMul(Math::rotationX(p), Math::matrixMul(Math::rotationY(y), Math::rotationZ(r)));
+        err_pyr = fmax(err_pyr, matDiff(Math::pitch_yaw_roll(p, y, r), ref));
+        MATRIX4 m = randomAffine();
+        err_inv = fmax(err_inv, matDiff(Math::matrixMul(Math::affineInverse(m), m), id));
+    }
+    printf("pitch_yaw_roll   max diff to rotationX * rotationY * rotationZ %g\n", err_pyr);
+    printf("affineInverse    max diff of inverse(M) * M to I %g\n", err_inv);
+    CHECK(err_pyr < 1e-5f);
+    CHECK(err_inv < 1e-4f);
+}
+
+/* inverse transpose of the 3x3 part by Gauss-Jordan in double, applied
+   per normal */
+__attribute__((noinline)) static void
+scalarTransformNormals(const MATRIX4 &m, const VEC3 *in, VEC3 *out, size_t n) {
+    double a[3][6];
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 6; ++j) a[i][j] = j < 3 ? m.mat[i][j] : (j - 3 == i);
+    for (int c = 0; c < 3; ++c) {
+        int piv = c;
+        for (int r = c + 1; r < 3; ++r) if (fabs(a[r][c]) > fabs(a[piv][c])) piv = r;
+        for (int j = 0; j < 6; ++j) swap(a[c][j], a[piv][j]);
+        for (int r = 0; r < 3; ++r) {
+            if (r == c) continue;
+            double f = a[r][c] / a[c][c];
+            for (int j = 0; j < 6; ++j) a[r][j] -= f * a[c][j];
+        }
+    }
+    float it[3][3];                          /* transpose(inverse) */
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 3; ++j) it[i][j] = (float)(a[j][i + 3] / a[j][j]);
+    for (size_t k = 0; k < n; ++k) {
+        VEC3 v = in[k];
+        VEC3 r = {it[0][0] * v.x + it[0][1] * v.y + it[0][2] * v.z,
+                  it[1][0] * v.x + it[1][1] * v.y + it[1][2] * v.z,
+                  it[2][0] * v.x + it[2][1] * v.y + it[2][2] * v.z};
+        out[k] = r.normalize();
+    }
+}
+
+static void
+benchTransformNormals() {
+    const size_t n = 1 << 16, rounds = 1 << 6;
+    vector<VEC3> in(n), ref(n), out(n);
+    for (size_t i = 0; i < n; ++i) in[i] = ((VEC3){randf(-1, 1), randf(-1, 1), randf(-1, 1)}).normalize();
+    float err = 0;
+    for (int k = 0; k < 16; ++k) {
+        MATRIX4 m = randomAffine();
+        scalarTransformNormals(m, in.data(), ref.data(), n);
+        Math::transformNormals(m, in.data(), out.data(), n);
+        for (size_t i = 0; i < n; ++i)
+            err = fmax(err, fmax(fabs(ref[i].x - out[i].x), fmax(fabs(ref[i].y - out[i].y), fabs(ref[i].z - out[i].z))));
+    }
+    MATRIX4 m = randomAffine();
+    double ts = timeLoop(rounds, [&](size_t) { scalarTransformNormals(m, in.data(), ref.data(), n); }) / n;
+    double tv = timeLoop(rounds, [&](size_t) { Math::transformNormals(m, in.data(), out.data(), n); }) / n;
+    sink = ref[7].x + out[7].x;
+    printf("normals / vtx    ref %6.2f ns  Math %6.2f ns  x%.2f  max diff %g\n", ts, tv, ts / tv, err);
+    CHECK(err < 1e-4f);
+}
+
+int main() {
+#ifdef __AVX__
+    printf("SSE + AVX\n");
+#elif defined(__SSE__)
+    printf("SSE\n");
+#else
+    printf("scalar fallback\n");
+#endif
+    benchMatrixMul();
+    benchMatrixVecMul();
+    benchClipSpace();
+    benchTransformNormals();
+    checkMatrices();
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures;
+}
\ No newline at end of file
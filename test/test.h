@@ -0,0 +1,97 @@
+/*
+Copyright (c) 2018 Zhang Weijia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __PIXPIX_TEST_H__
+#define __PIXPIX_TEST_H__
+
+/* minimal test helpers, every test is a program returning the number of
+   failed checks */
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include "../src/pixpix.h"
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { \
+    printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+namespace pixpix {
+
+/* difference between two canvases of the same size */
+struct IMAGE_DIFF {
+    unsigned pixels;                        /* pixels with any channel off    */
+    unsigned maxLevel;                      /* largest channel difference     */
+};
+
+static inline IMAGE_DIFF
+diffImages(const std::vector<unsigned char> &a, const std::vector<unsigned char> &b) {
+    IMAGE_DIFF d = {0, 0};
+    for (size_t p = 0; p + 2 < a.size() && p + 2 < b.size(); p += 3) {
+        bool off = false;
+        for (int c = 0; c < 3; ++c) {
+            unsigned l = a[p+c] > b[p+c] ? a[p+c] - b[p+c] : b[p+c] - a[p+c];
+            if (l > 0) off = true;
+            if (l > d.maxLevel) d.maxLevel = l;
+        }
+        if (off) ++d.pixels;
+    }
+    return d;
+}
+
+/* lit, textured scene around the origin seen from (0, 3, 6) */
+struct TEST_SCENE {
+    CANVAS canvas;
+    CAMERA camera;
+    RenderPipeline3D pipe;
+    TEXTURE texture;
+    MATERIAL material;
+    LIGHT light;
+
+    TEST_SCENE(unsigned w, unsigned h): canvas(w, h), pipe(&canvas, &camera) {
+        camera.position = (VEC3){0, 3, 6};
+        camera.lookAt(0, 0, 0);
+        camera.aspect_ratio = (float)w / h;
+        camera.fovY = Math::Pi / 3;
+        texture.ty = T_CHESS_BOARD;
+        texture.sz = 8;
+        texture.color1 = (COLOR4){1.0f, 0.5f, 0.5f, 1.0f};
+        texture.color2 = (COLOR4){0.3f, 0.3f, 0.3f, 1.0f};
+        light.mPosition = (VEC3){1, 4, 1};
+        light.mAmbientColor = (COLOR3){0.2f, 0.2f, 0.2f};
+        light.mDiffuseIntensity = 0.8f;
+    }
+
+    std::vector<unsigned char> render(const std::vector<MESH> &meshes) {
+        pipe.init();
+        pipe.addLight(light);
+        pipe.setTexture(&texture);
+        pipe.setMaterial(&material);
+        for (size_t i = 0; i < meshes.size(); ++i) pipe.render(meshes[i]);
+        pipe.flush();
+        return std::vector<unsigned char>(canvas.img, canvas.img + canvas.w * canvas.h * 3);
+    }
+};
+
+}
+
+#endif
\ No newline at end of file
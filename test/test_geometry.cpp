@@ -0,0 +1,111 @@
+/*
+Copyright (c) 2018 Zhang Weijia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* vertex cache optimization of the generators: ACMR drops, and every
+   per-corner stream, float or quantized, follows its corner */
+#include <cstdlib>
+#include <algorithm>
+#include "test.h"
+
+using namespace pixpix;
+
+/* random triangle order, the order of a mesh from an arbitrary source */
+static void
+shuffleTriangles(MESH &mesh) {
+    size_t nf = mesh.vertexIndex->size() / 3;
+    vector<unsigned> order(nf);
+    for (size_t i = 0; i < nf; ++i) order[i] = i;
+    for (size_t i = nf - 1; i > 0; --i) swap(order[i], order[rand() % (i + 1)]);
+
+    MESH old = mesh;
+    vector<unsigned> idx(nf * 3);
+    vector<VEC3> normal(nf * 3);
+    vector<VEC2> tex(nf * 3);
+    vector<short> np(nf * 6), tp(nf * 6);
+    for (size_t i = 0; i < nf; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            size_t c = order[i] * 3 + k, d = i * 3 + k;
+            idx[d] = (*old.vertexIndex)[c];
+            normal[d] = (*old.normal)[c];
+            tex[d] = (*old.texCoord)[c];
+            for (int j = 0; j < 2; ++j) {
+                np[d*2+j] = (*old.normalPacked)[c*2+j];
+                tp[d*2+j] = (*old.texCoordPacked)[c*2+j];
+            }
+        }
+    }
+    mesh.vertexIndex->swap(idx);
+    mesh.normal->swap(normal);
+    mesh.texCoord->swap(tex);
+    mesh.normalPacked->swap(np);
+    mesh.texCoordPacked->swap(tp);
+}
+
+/* quantized copies next to the float streams */
+static void
+addPackedStreams(MESH &mesh) {
+    size_t n = mesh.vertexIndex->size();
+    mesh.normalPacked = new vector<short>(n * 2);
+    mesh.texCoordPacked = new vector<short>(n * 2);
+    for (size_t c = 0; c < n; ++c) {
+        Packing::packNormal((*mesh.normal)[c], &(*mesh.normalPacked)[c*2]);
+        Packing::packTexCoord((*mesh.texCoord)[c], &(*mesh.texCoordPacked)[c*2]);
+    }
+}
+
+/* every corner's quantized attributes still encode its float ones */
+static bool
+streamsMatch(const MESH &mesh) {
+    for (size_t c = 0; c < mesh.vertexIndex->size(); ++c) {
+        short n[2], t[2];
+        Packing::packNormal((*mesh.normal)[c], n);
+        Packing::packTexCoord((*mesh.texCoord)[c], t);
+        if (n[0] != (*mesh.normalPacked)[c*2] || n[1] != (*mesh.normalPacked)[c*2+1]) return false;
+        if (t[0] != (*mesh.texCoordPacked)[c*2] || t[1] != (*mesh.texCoordPacked)[c*2+1]) return false;
+    }
+    return true;
+}
+
+static void
+testACMR(const char *name, MESH mesh) {
+    float generated = Geometry::getACMR(mesh);
+    addPackedStreams(mesh);
+    shuffleTriangles(mesh);
+    float shuffled = Geometry::getACMR(mesh);
+    Geometry::optimizeVertexCache(mesh);
+    float optimized = Geometry::getACMR(mesh);
+    printf("%-9s %6u faces  ACMR shuffled %.3f -> optimized %.3f (generated %.3f)\n",
+           name, (unsigned)mesh.vertexIndex->size() / 3, shuffled, optimized, generated);
+    CHECK(optimized < shuffled);
+    CHECK(optimized < 0.8f);
+    CHECK(generated < 0.8f);
+    CHECK(streamsMatch(mesh));
+}
+
+int main() {
+    testACMR("sphere", Geometry::sphere(1.0f, 64, 32));
+    testACMR("cube", Geometry::cube(1.0f, 16));
+    testACMR("cylinder", Geometry::cylinder(1.0f, 2.0f, 64, 16));
+    testACMR("teapot", Geometry::teapot(1.0f, 8));
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures;
+}
\ No newline at end of file
@@ -0,0 +1,116 @@
+/*
+Copyright (c) 2018 Zhang Weijia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* MultiViewRenderer shares shadow maps and unpacked attributes between
+   views and threads, every view must still equal a single view render */
+#include <cstring>
+#include "test.h"
+
+using namespace pixpix;
+
+static void
+move(MESH &m, VEC3 d) {
+    for (size_t i = 0; i < m.verts->size(); ++i) (*m.verts)[i] = (*m.verts)[i] + d;
+}
+
+static void
+testViewsMatchSingleView() {
+    const unsigned W = 160, H = 120, N = 8;
+    TEXTURE tex;
+    tex.ty = T_CHESS_BOARD;
+    tex.sz = 8;
+    tex.color1 = (COLOR4){1.0f, 0.5f, 0.5f, 1.0f};
+    tex.color2 = (COLOR4){0.3f, 0.3f, 0.3f, 1.0f};
+    MATERIAL mat;
+
+    MESH floor = Geometry::cube(1.0f, 4);
+    for (size_t i = 0; i < floor.verts->size(); ++i) {
+        VEC3 &v = (*floor.verts)[i];
+        v = (VEC3){v.x * 6.0f, v.y * 0.1f - 0.05f, v.z * 6.0f};
+    }
+    MESH cube = Geometry::cube(1.0f, 2), teapot = Geometry::teapot(1.0f, 6), far_away = Geometry::sphere(1.0f);
+    move(cube, (VEC3){0, 1.0f, 0});
+    move(teapot, (VEC3){1.5f, 0, 1.5f});
+    move(far_away, (VEC3){0, 0, 40});
+
+    LIGHT light;
+    light.mPosition = (VEC3){0.5f, 4, 0.5f};
+    light.mAmbientColor = (COLOR3){0.1f, 0.1f, 0.1f};
+    light.mDiffuseIntensity = 0.8f;
+    light.mCastShadow = true;
+
+    /* the packed teapot takes the shared unpack path, the far sphere is
+       culled from most views */
+    SCENE scene;
+    scene.lights.push_back(light);
+    scene.casters = vector<MESH>{cube, floor, teapot};
+    scene.draws.push_back((DRAW_CALL){floor, &tex, &mat});
+    scene.draws.push_back((DRAW_CALL){cube, &tex, &mat});
+    scene.draws.push_back((DRAW_CALL){Packing::packMesh(teapot), &tex, &mat});
+    scene.draws.push_back((DRAW_CALL){far_away, &tex, &mat});
+
+    vector<CAMERA> cams(N);
+    vector<CANVAS *> canvases;
+    vector<VIEW> views;
+    for (unsigned i = 0; i < N; ++i) {
+        float a = 2 * Math::Pi * i / N;
+        cams[i].position = (VEC3){6 * sinf(a), 4, 6 * cosf(a)};
+        cams[i].lookAt(0, 0, 0);
+        cams[i].aspect_ratio = (float)W / H;
+        cams[i].fovY = Math::Pi / 3;
+        canvases.push_back(new CANVAS(W, H));
+        views.push_back((VIEW){&cams[i], canvases[i]});
+    }
+
+    MultiViewRenderer mvr(3);
+    mvr.setShadow(256);
+    /* the second call runs on cached shadow maps */
+    for (int call = 0; call < 2; ++call) {
+        MULTI_VIEW_STATS stats = mvr.render(scene, views);
+        CHECK(stats.views == N && stats.threads == 3);
+        unsigned mismatched = 0;
+        for (unsigned i = 0; i < N; ++i) {
+            CANVAS ref(W, H);
+            RenderPipeline3D pipe(&ref, &cams[i]);
+            pipe.setShadow(256);
+            pipe.init();
+            pipe.addLight(light);
+            for (size_t c = 0; c < scene.casters.size(); ++c) pipe.addShadowCaster(scene.casters[c]);
+            for (size_t d = 0; d < scene.draws.size(); ++d) {
+                pipe.setTexture(scene.draws[d].texture);
+                pipe.setMaterial(scene.draws[d].material);
+                pipe.render(scene.draws[d].mesh);
+            }
+            pipe.flush();
+            if (memcmp(ref.img, canvases[i]->img, W * H * 3) != 0) ++mismatched;
+        }
+        printf("call %d: %u views on %u threads, %u differ from single view\n", call, N, stats.threads, mismatched);
+        CHECK(mismatched == 0);
+    }
+    for (unsigned i = 0; i < N; ++i) delete canvases[i];
+}
+
+int main() {
+    testViewsMatchSingleView();
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures;
+}
\ No newline at end of file
@@ -0,0 +1,160 @@
+/*
+Copyright (c) 2018 Zhang Weijia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* quantized attributes: round trip error bounds, packed against float
+   rendering, and simplification of packed meshes */
+#include <cstdlib>
+#include "test.h"
+
+using namespace pixpix;
+
+static float
+randf(float lo, float hi) {
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+static void
+testRoundTrip() {
+    /* octahedral normals, within 0.05 degrees */
+    float max_angle = 0;
+    for (int i = 0; i < 100000; ++i) {
+        VEC3 n = ((VEC3){randf(-1, 1), randf(-1, 1), randf(-1, 1)});
+        if (n * n < 1e-6f) continue;
+        n = n.normalize();
+        short p[2];
+        Packing::packNormal(n, p);
+        VEC3 d = Packing::unpackNormal(p);
+        float c = n * d;
+        max_angle = fmax(max_angle, acosf(fmin(c, 1.0f)) * 180.0f / Math::Pi);
+    }
+    printf("normal: max error %.4f deg\n", max_angle);
+    CHECK(max_angle < 0.05f);
+
+    /* 4.12 texture coordinates, within half a step */
+    float max_tex = 0;
+    for (int i = 0; i < 100000; ++i) {
+        VEC2 t = (VEC2){randf(-7.99f, 7.99f), randf(-7.99f, 7.99f)};
+        short p[2];
+        Packing::packTexCoord(t, p);
+        VEC2 d = Packing::unpackTexCoord(p);
+        max_tex = fmax(max_tex, fmax(fabs(d.x - t.x), fabs(d.y - t.y)));
+    }
+    printf("tex coord: max error %g\n", max_tex);
+    CHECK(max_tex <= 0.5f / 4096.0f + 1e-6f);
+
+    /* RGBA8, within half a level */
+    float max_color = 0;
+    for (int i = 0; i < 10000; ++i) {
+        COLOR4 c = (COLOR4){randf(0, 1), randf(0, 1), randf(0, 1), randf(0, 1)};
+        COLOR4 d = Packing::unpackColor(Packing::packColor(c));
+        max_color = fmax(max_color, fmax(fmax(fabs(d.x - c.x), fabs(d.y - c.y)), fmax(fabs(d.z - c.z), fabs(d.w - c.w))));
+    }
+    printf("color: max error %g\n", max_color);
+    CHECK(max_color <= 0.5f / 255.0f + 1e-6f);
+
+    /* batch decoders agree with the scalar ones */
+    std::vector<short> packed(2 * 1001);
+    for (size_t i = 0; i < packed.size(); ++i) packed[i] = (short)(rand() % 65536 - 32768);
+    std::vector<VEC3> normals(1001);
+    std::vector<VEC2> tex(1001);
+    Packing::unpackNormals(packed.data(), normals.data(), 1001);
+    Packing::unpackTexCoords(packed.data(), tex.data(), 1001);
+    float max_batch = 0;
+    for (size_t i = 0; i < 1001; ++i) {
+        VEC3 n = Packing::unpackNormal(&packed[i * 2]);
+        VEC2 t = Packing::unpackTexCoord(&packed[i * 2]);
+        max_batch = fmax(max_batch, fmax(fabs(n.x - normals[i].x), fmax(fabs(n.y - normals[i].y), fabs(n.z - normals[i].z))));
+        max_batch = fmax(max_batch, fmax(fabs(t.x - tex[i].x), fabs(t.y - tex[i].y)));
+    }
+    CHECK(max_batch < 1e-6f);
+}
+
+static void
+testPackedRender() {
+    TEST_SCENE scene(320, 240);
+    MESH teapot = Geometry::teapot(1.5f, 8);
+    MESH sphere = Geometry::sphere(0.6f, 32, 16);
+    for (size_t i = 0; i < sphere.verts->size(); ++i)
+        (*sphere.verts)[i] = (*sphere.verts)[i] + (VEC3){2.0f, 0.6f, 0};
+    std::vector<unsigned char> ref = scene.render(std::vector<MESH>{teapot, sphere});
+
+    MESH teapot_packed = Packing::packMesh(teapot), sphere_packed = Packing::packMesh(sphere);
+    CHECK(teapot_packed.normal == nullptr && teapot_packed.normalPacked != nullptr);
+    CHECK(teapot.normal != nullptr && teapot.normalPacked == nullptr);
+    std::vector<unsigned char> img = scene.render(std::vector<MESH>{teapot_packed, sphere_packed});
+    IMAGE_DIFF d = diffImages(ref, img);
+    printf("packed render: %u of %u pixels differ, at most %u levels\n", d.pixels, 320 * 240, d.maxLevel);
+    CHECK(d.pixels <= 320 * 240 / 1000);
+    CHECK(d.maxLevel <= 4);
+}
+
+static void
+testPackedLOD() {
+    TEST_SCENE scene(160, 120);
+    MESH full = Geometry::teapot(1.5f, 8);
+    MESH_LOD ref = MeshSimplifier::buildLOD(full, 4);
+    MESH packed = Packing::packMesh(Geometry::teapot(1.5f, 8));
+    MESH_LOD lod = MeshSimplifier::buildLOD(packed, 4);
+
+    CHECK(lod.levels.size() == ref.levels.size());
+    CHECK(lod.levels.size() >= 3);
+    for (size_t i = 0; i < lod.levels.size() && i < ref.levels.size(); ++i) {
+        MESH &m = lod.levels[i];
+        size_t corners = m.vertexIndex->size();
+        CHECK(m.normal == nullptr && m.texCoord == nullptr);
+        CHECK(m.normalPacked != nullptr && m.normalPacked->size() == corners * 2);
+        CHECK(m.texCoordPacked != nullptr && m.texCoordPacked->size() == corners * 2);
+        CHECK(lod.faceCount[i] == ref.faceCount[i]);
+
+        IMAGE_DIFF d = diffImages(scene.render(std::vector<MESH>{ref.levels[i]}),
+                                  scene.render(std::vector<MESH>{m}));
+        printf("LOD %u (%u faces): %u pixels differ from float, at most %u levels\n",
+               (unsigned)i, lod.faceCount[i], d.pixels, d.maxLevel);
+        CHECK(d.pixels <= 160 * 120 / 200);
+    }
+}
+
+/* packing a mesh leaves the LOD chain built from it intact */
+static void
+testPackAfterLOD() {
+    TEST_SCENE scene(160, 120);
+    MESH mesh = Geometry::teapot(1.5f, 8);
+    MESH_LOD lod = MeshSimplifier::buildLOD(mesh, 3);
+    std::vector<unsigned char> before = scene.render(std::vector<MESH>{lod.levels[0]});
+
+    MESH packed = Packing::packMesh(mesh);
+    CHECK(lod.levels[0].normal != nullptr && lod.levels[0].normal == mesh.normal);
+    IMAGE_DIFF d = diffImages(before, scene.render(std::vector<MESH>{lod.levels[0]}));
+    CHECK(d.pixels == 0);
+    d = diffImages(before, scene.render(std::vector<MESH>{packed}));
+    printf("pack after LOD: level 0 unchanged, packed copy %u pixels off\n", d.pixels);
+    CHECK(d.pixels <= 160 * 120 / 200);
+}
+
+int main() {
+    testRoundTrip();
+    testPackedRender();
+    testPackedLOD();
+    testPackAfterLOD();
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures;
+}
\ No newline at end of file
@@ -0,0 +1,135 @@
+/*
+Copyright (c) 2018 Zhang Weijia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/* triangle setup shrinks the pixel rectangle and drops triangles without
+   area before the coverage loop, the pixels must be those of the loop over
+   the whole bounds */
+#include <cstring>
+#include "test.h"
+
+using namespace pixpix;
+
+/* coverage of `meshes` by the generic loop: the bounds of getTriangleRect,
+   the three BETWEEN tests and the z test on every candidate, white where a
+   fragment was written */
+static vector<unsigned char>
+referenceCoverage(const vector<MESH> &meshes, CAMERA &camera, unsigned w, unsigned h) {
+    vector<unsigned char> img(w * h * 3, 0);
+    vector<float> zbuf(w * h, INFINITY);
+    MATRIX4 m = Math::matrixMul(
+        Math::projection(camera.fovY, camera.aspect_ratio, camera.nearZ, camera.farZ),
+        Math::matrixMul(
+            Math::pitch_yaw_roll(-camera.rotation.x, -camera.rotation.y, -camera.rotation.z),
+            Math::translation(-camera.position.x, -camera.position.y, -camera.position.z)));
+    for (size_t k = 0; k < meshes.size(); ++k) {
+        const MESH &mesh = meshes[k];
+        vector<VEC4> homo(mesh.verts->size());
+        Math::transformPoints(m, mesh.verts->data(), homo.data(), homo.size());
+        for (size_t p = 0; p + 2 < mesh.vertexIndex->size(); p += 3) {
+            VEC4 v_homo[3];
+            VEC2 v2d[3];
+            for (int i = 0; i < 3; ++i) {
+                v_homo[i] = homo[(*mesh.vertexIndex)[p + i]];
+                v2d[i] = (VEC2){v_homo[i].getx(), v_homo[i].gety()};
+            }
+            if (((v2d[1]-v2d[0])^(v2d[2]-v2d[0])) < 0) continue;
+            bool clipped = true;
+            float minX = 1, minY = 1, maxX = -1, maxY = -1;
+            for (int i = 0; i < 3; ++i) {
+                float x = v_homo[i].getx(), y = v_homo[i].gety(), z = v_homo[i].z;
+                if (x >= -1 && x <= 1 && y >= -1 && y <= 1 && z >= camera.nearZ && z <= camera.farZ)
+                    clipped = false;
+                minX = min(minX, x); minY = min(minY, y);
+                maxX = max(maxX, x); maxY = max(maxY, y);
+            }
+            if (clipped) continue;
+            int x0 = (int)((max(-1.0f, minX) + 1) / 2 * w);
+            int x1 = min((int)((min(1.0f, maxX) + 1) / 2 * w), (int)w - 1);
+            int y0 = (int)((-min(1.0f, maxY) + 1) / 2 * h);
+            int y1 = min((int)((-max(-1.0f, minY) + 1) / 2 * h), (int)h - 1);
+            for (int i = 0; i < 3; ++i)
+                v2d[i] = (VEC2){(float)(v2d[i].x + 1) / 2 * w, (float)(-v2d[i].y + 1) / 2 * h};
+            for (int x = x0; x <= x1; ++x) {
+                for (int y = y0; y <= y1; ++y) {
+                    VEC2 pos = (VEC2){(float)x, (float)y};
+#define BETWEEN(a, b, c, d) (((b-a)^(d-a))*((d-a)^(c-a))>=-1e-6)
+                    if (!(BETWEEN(v2d[0], v2d[1], v2d[2], pos) &&
+                          BETWEEN(v2d[1], v2d[0], v2d[2], pos) &&
+                          BETWEEN(v2d[2], v2d[0], v2d[1], pos))) continue;
+#undef BETWEEN
+                    VEC2 v1 = v2d[1] - v2d[0], v2 = v2d[2] - v2d[0], d = pos - v2d[0];
+                    float det = v1.x * v2.y - v1.y * v2.x;
+                    float s = (v2.y * d.x - v2.x * d.y) / det;
+                    float t = (- v1.y * d.x + v1.x * d.y) / det;
+                    float depth = 1.0f / ((1-s-t)/v_homo[0].z + s/v_homo[1].z + t/v_homo[2].z);
+                    if (!(depth <= zbuf[x + y * w])) continue;
+                    zbuf[x + y * w] = depth;
+                    memset(&img[(x + y * w) * 3], 255, 3);
+                }
+            }
+        }
+    }
+    return img;
+}
+
+/* renders untextured, so every written fragment is opaque white */
+static void
+checkCoverage(const char *name, const vector<MESH> &meshes, unsigned w, unsigned h) {
+    TEST_SCENE scene(w, h);
+    scene.pipe.init();
+    scene.pipe.setTexture(nullptr);
+    scene.pipe.setMaterial(nullptr);
+    for (size_t i = 0; i < meshes.size(); ++i) scene.pipe.render(meshes[i]);
+    scene.pipe.flush();
+    vector<unsigned char> img(scene.canvas.img, scene.canvas.img + w * h * 3);
+    vector<unsigned char> ref = referenceCoverage(meshes, scene.camera, w, h);
+    unsigned lit = 0;
+    for (size_t p = 0; p < ref.size(); p += 3) lit += ref[p] != 0;
+    IMAGE_DIFF d = diffImages(img, ref);
+    printf("%s: %u pixels covered, %u differ\n", name, lit, d.pixels);
+    CHECK(lit > 0);
+    CHECK(img == ref);
+}
+
+/* triangles with a vertex on the line between the other two, and one with
+   all three on a pixel sample */
+static MESH
+degenerate() {
+    MESH m;
+    m.verts = new vector<VEC3>{{-1, 0, 0}, {0, 0, 0}, {1, 0, 0}, {0, 1, 0}, {0, 1, 0}};
+    m.faceIndex = new vector<unsigned>{3, 3};
+    m.vertexIndex = new vector<unsigned>{0, 1, 2, 3, 4, 3};
+    m.normal = new vector<VEC3>(6, (VEC3){0, 0, 1});
+    m.texCoord = new vector<VEC2>(6, (VEC2){0, 0});
+    return m;
+}
+
+int main() {
+    /* most triangles of the dense meshes cover a pixel or none */
+    MESH teapot = Geometry::teapot(3.0f, 24), sphere = Geometry::sphere(2.5f, 256, 128);
+    checkCoverage("dense teapot, 160x120", {teapot}, 160, 120);
+    checkCoverage("dense teapot, 640x480", {teapot}, 640, 480);
+    checkCoverage("dense sphere, 160x120", {sphere}, 160, 120);
+    checkCoverage("coarse, 97x61", {Geometry::cube(2.0f), Geometry::cylinder(0.8f, 2.5f)}, 97, 61);
+    checkCoverage("degenerate", {degenerate(), Geometry::sphere(0.3f)}, 80, 60);
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures;
+}
\ No newline at end of file
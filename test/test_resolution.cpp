@@ -0,0 +1,98 @@
+/*
+Copyright (c) 2018 Zhang Weijia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/* the resolution controller must settle inside its bounds and stay there */
+#include "test.h"
+
+using namespace pixpix;
+
+/* feeds the same frame time n times, fails if the scale leaves the bounds
+   or turns back, returns the last scale */
+static float
+feedFixed(ResolutionController &rc, double frame_seconds, int n) {
+    float last = rc.getScale();
+    int dir = 0;
+    for (int i = 0; i < n; i++) {
+        float s = rc.update(frame_seconds);
+        CHECK(s >= rc.getMinScale() && s <= rc.getMaxScale());
+        int d = s > last ? 1 : s < last ? -1 : 0;
+        if (d) {
+            CHECK(dir == 0 || dir == d);
+            dir = d;
+        }
+        last = s;
+    }
+    return last;
+}
+
+static void
+testFixedFrameTime() {
+    /* twice over budget: shrinks to the lower bound */
+    ResolutionController slow(1.0 / 60, 0.25f, 1.0f);
+    CHECK(feedFixed(slow, 2.0 / 60, 64) == 0.25f);
+    /* well under budget: grows back to the upper bound */
+    CHECK(feedFixed(slow, 0.2 / 60, 64) == 1.0f);
+}
+
+static void
+testSettles() {
+    /* frame time grows with the pixel count, scale^2; full size costs
+       twice the budget, so the answer lies strictly inside the bounds */
+    ResolutionController rc(1.0 / 60, 0.25f, 1.0f);
+    float s = rc.getScale(), prev = s;
+    int changes = 0;
+    for (int i = 0; i < 200; i++) {
+        prev = s;
+        s = rc.update(2.0 / 60 * s * s);
+        CHECK(s >= 0.25f && s <= 1.0f);
+        if (s != prev && i >= 100) changes++;
+    }
+    printf("settled at %.3f\n", s);
+    CHECK(changes == 0);
+    CHECK(s > 0.25f && s < 1.0f);
+    /* the settled frame fits the budget without wasting much of it */
+    double t = 2.0 / 60 * s * s;
+    CHECK(t <= 1.0 / 60 && t > 0.7 / 60);
+}
+
+static void
+testBounds() {
+    ResolutionController rc(1.0 / 60, 1.0f, 0.5f);
+    CHECK(rc.getMinScale() == 0.5f && rc.getMaxScale() == 1.0f);
+    CHECK(rc.getScale() == 1.0f);
+
+    rc.setScaleBounds(0.0f, 0.75f);
+    CHECK(rc.getMinScale() == ResolutionController::MinScale);
+    CHECK(rc.getScale() == 0.75f);
+    CHECK(feedFixed(rc, 1.0, 256) == ResolutionController::MinScale);
+
+    rc.setScaleBounds(-1.0f, -2.0f);
+    CHECK(rc.getMinScale() > 0 && rc.getMaxScale() >= rc.getMinScale());
+    CHECK(rc.getScale() > 0);
+}
+
+int main() {
+    testFixedFrameTime();
+    testSettles();
+    testBounds();
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures;
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+/*
+Copyright (c) 2018 Zhang Weijia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* retained mode patches the previous frame, the result must equal an
+   immediate mode frame byte for byte */
+#include "test.h"
+
+using namespace pixpix;
+
+struct RETAINED_SCENE {
+    TEST_SCENE scene;
+    MESH floor, cube, sphere;
+
+    RETAINED_SCENE(): scene(160, 120) {
+        floor = Geometry::cube(1.0f, 4);
+        for (size_t i = 0; i < floor.verts->size(); ++i) {
+            VEC3 &v = (*floor.verts)[i];
+            v = (VEC3){v.x * 6.0f, v.y * 0.1f - 0.05f, v.z * 6.0f};
+        }
+        cube = Geometry::cube(1.0f, 2);
+        sphere = Geometry::sphere(0.5f, 24, 12);
+        move(sphere, (VEC3){-1.5f, 0.5f, 0});
+        move(cube, (VEC3){0.5f, 0.5f, 0});
+        scene.light.mCastShadow = true;
+        scene.pipe.setShadow(256);
+    }
+
+    static void move(MESH &m, VEC3 d) {
+        for (size_t i = 0; i < m.verts->size(); ++i) (*m.verts)[i] = (*m.verts)[i] + d;
+    }
+
+    vector<unsigned char> frame() {
+        return scene.render(vector<MESH>{floor, cube, sphere});
+    }
+};
+
+static void
+testMovingObject() {
+    RETAINED_SCENE imm, ret;
+    ret.scene.pipe.setRetained(true);
+    for (int f = 0; f < 8; ++f) {
+        /* one object moves per frame, some frames nothing does */
+        VEC3 d = (VEC3){0.15f, 0, 0.05f * (f % 3)};
+        if (f % 4 != 3) {
+            RETAINED_SCENE::move(f % 2 ? imm.cube : imm.sphere, d);
+            RETAINED_SCENE::move(f % 2 ? ret.cube : ret.sphere, d);
+        }
+        IMAGE_DIFF diff = diffImages(imm.frame(), ret.frame());
+        if (diff.pixels) printf("frame %d: %u pixels differ\n", f, diff.pixels);
+        CHECK(diff.pixels == 0);
+    }
+}
+
+/* switching to another canvas of the same size must redraw everything */
+static void
+testCanvasSwitch() {
+    RETAINED_SCENE imm, ret;
+    ret.scene.pipe.setRetained(true);
+    ret.frame();
+    CANVAS other(160, 120);
+    ret.scene.pipe.setCanvas(&other);
+    RETAINED_SCENE::move(ret.cube, (VEC3){0.2f, 0, 0});
+    RETAINED_SCENE::move(imm.cube, (VEC3){0.2f, 0, 0});
+    ret.frame();
+    vector<unsigned char> expect = imm.frame();
+    IMAGE_DIFF diff = diffImages(expect, vector<unsigned char>(other.img, other.img + 160 * 120 * 3));
+    if (diff.pixels) printf("canvas switch: %u pixels differ\n", diff.pixels);
+    CHECK(diff.pixels == 0);
+}
+
+int main() {
+    testMovingObject();
+    testCanvasSwitch();
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures;
+}
\ No newline at end of file
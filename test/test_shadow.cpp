@@ -0,0 +1,77 @@
+/*
+Copyright (c) 2018 Zhang Weijia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* shadow maps: a caster spanning several cube faces of a point light
+   casts its whole shadow */
+#include "test.h"
+
+using namespace pixpix;
+
+/* horizontal square at height y, 2 * half on a side */
+static MESH
+square(float y, float half) {
+    MESH m;
+    m.verts = new vector<VEC3>{{-half, y, -half}, {half, y, -half}, {half, y, half}, {-half, y, half}};
+    m.faceIndex = new vector<unsigned>{3, 3};
+    m.vertexIndex = new vector<unsigned>{0, 2, 1, 0, 3, 2};
+    return m;
+}
+
+static void
+testPointLightEdge() {
+    CANVAS canvas(4, 4);
+    CAMERA camera;
+    RenderPipeline3D pipe(&canvas, &camera);
+    LIGHT light;
+    light.mPosition = (VEC3){0, 2, 0};
+    light.mCastShadow = true;
+
+    pipe.setShadow(512, 0);
+    pipe.init();
+    pipe.addLight(light);
+    pipe.addShadowCaster(square(1.0f, 1.2f));
+    pipe.addShadowCaster(square(0.0f, 4.0f));
+    pipe.prepareShadowMaps();
+
+    /* the square's edge projects to 2.4 on the floor, the points near it
+       are seen through the side faces of the cube map */
+    const float d[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+    for (int i = 0; i < 4; ++i) {
+        for (float r = 0.0f; r <= 2.3f; r += 0.1f) {
+            float f = pipe.shadowFactor(0, (VEC3){d[i][0] * r, 0, d[i][1] * r});
+            if (f != 0.0f) printf("lit at r = %.1f along (%g, %g)\n", r, d[i][0], d[i][1]);
+            CHECK(f == 0.0f);
+        }
+        CHECK(pipe.shadowFactor(0, (VEC3){d[i][0] * 2.5f, 0, d[i][1] * 2.5f}) == 1.0f);
+        CHECK(pipe.shadowFactor(0, (VEC3){d[i][0] * 3.5f, 0, d[i][1] * 3.5f}) == 1.0f);
+    }
+    /* under the corners */
+    CHECK(pipe.shadowFactor(0, (VEC3){2.2f, 0, 2.2f}) == 0.0f);
+    CHECK(pipe.shadowFactor(0, (VEC3){-2.2f, 0, 2.2f}) == 0.0f);
+    CHECK(pipe.shadowFactor(0, (VEC3){2.6f, 0, -2.6f}) == 1.0f);
+}
+
+int main() {
+    testPointLightEdge();
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures;
+}
\ No newline at end of file
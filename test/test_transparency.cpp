@@ -0,0 +1,139 @@
+/*
+Copyright (c) 2018 Zhang Weijia
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* transparent surfaces are resolved per pixel, the image must not depend
+   on the order they are drawn in */
+#include <cstring>
+#include "test.h"
+
+using namespace pixpix;
+
+/* square facing +z at depth z, centered at (cx, cy) */
+static MESH
+square(float cx, float cy, float z, float half) {
+    MESH m;
+    m.verts = new vector<VEC3>{{cx - half, cy - half, z}, {cx + half, cy - half, z},
+                               {cx + half, cy + half, z}, {cx - half, cy + half, z}};
+    m.faceIndex = new vector<unsigned>{3, 3};
+    m.vertexIndex = new vector<unsigned>{0, 1, 2, 0, 2, 3};
+    m.normal = new vector<VEC3>(6, (VEC3){0, 0, 1});
+    m.texCoord = new vector<VEC2>(6, (VEC2){0, 0});
+    return m;
+}
+
+struct LAYER {
+    MESH mesh;
+    TEXTURE texture;
+    MATERIAL material;
+};
+
+static vector<unsigned char>
+renderLayers(vector<LAYER> &layers, const unsigned *order) {
+    CANVAS canvas(120, 90);
+    CAMERA camera;
+    camera.position = (VEC3){0, 0, 5};
+    camera.lookAt(0, 0, 0);
+    camera.aspect_ratio = 120.0f / 90;
+    camera.fovY = Math::Pi / 3;
+    LIGHT light;
+    light.mPosition = (VEC3){0, 0, 5};
+    light.mAmbientColor = (COLOR3){0.3f, 0.3f, 0.3f};
+    light.mDiffuseIntensity = 0.7f;
+
+    RenderPipeline3D pipe(&canvas, &camera);
+    pipe.init();
+    pipe.addLight(light);
+    for (size_t i = 0; i < layers.size(); ++i) {
+        LAYER &l = layers[order[i]];
+        pipe.setTexture(&l.texture);
+        pipe.setMaterial(&l.material);
+        pipe.render(l.mesh);
+    }
+    pipe.flush();
+    return vector<unsigned char>(canvas.img, canvas.img + canvas.w * canvas.h * 3);
+}
+
+static void
+testOrderIndependence() {
+    /* an opaque backdrop and three overlapping translucent squares, at
+       most OIT_LAYERS deep everywhere */
+    const float opacity[4] = {1.0f, 0.5f, 0.4f, 0.6f};
+    const COLOR4 color[4] = {{0.2f, 0.2f, 0.8f, 1.0f}, {1.0f, 0.2f, 0.2f, 1.0f},
+                             {0.2f, 1.0f, 0.2f, 1.0f}, {1.0f, 1.0f, 0.2f, 1.0f}};
+    vector<LAYER> layers(4);
+    layers[0].mesh = square(0, 0, -1.0f, 3.0f);
+    layers[1].mesh = square(-0.4f, 0.2f, 0.0f, 0.8f);
+    layers[2].mesh = square(0.3f, 0.1f, 0.3f, 0.8f);
+    layers[3].mesh = square(0.0f, -0.3f, 0.6f, 0.8f);
+    for (int i = 0; i < 4; ++i) {
+        layers[i].texture.ty = T_COLOR;
+        layers[i].texture.color = color[i];
+        layers[i].material.opacity = opacity[i];
+    }
+
+    const unsigned orders[4][4] = {{0, 1, 2, 3}, {3, 2, 1, 0}, {2, 0, 3, 1}, {1, 3, 0, 2}};
+    vector<unsigned char> ref = renderLayers(layers, orders[0]);
+    for (int k = 1; k < 4; ++k) {
+        IMAGE_DIFF d = diffImages(ref, renderLayers(layers, orders[k]));
+        printf("order %u%u%u%u: %u pixels differ\n", orders[k][0], orders[k][1], orders[k][2], orders[k][3], d.pixels);
+        CHECK(d.pixels == 0);
+    }
+
+    /* the squares really are blended: the overlap of all three differs
+       from each single square over the backdrop */
+    size_t center = (45 * 120 + 60) * 3;
+    CHECK(memcmp(&ref[center], &ref[(45 * 120 + 5) * 3], 3) != 0);
+}
+
+/* untextured draws are opaque white, or blended by material opacity */
+static void
+testUntextured() {
+    CANVAS canvas(40, 30);
+    CAMERA camera;
+    camera.position = (VEC3){0, 0, 5};
+    camera.lookAt(0, 0, 0);
+    camera.aspect_ratio = 40.0f / 30;
+    camera.fovY = Math::Pi / 3;
+    RenderPipeline3D pipe(&canvas, &camera);
+    MATERIAL half;
+    half.opacity = 0.5f;
+
+    pipe.init();
+    pipe.render(square(0, 0, 0, 2.0f));
+    pipe.flush();
+    CHECK(canvas.img[(15 * 40 + 20) * 3] == 255);
+
+    pipe.init();
+    pipe.setMaterial(&half);
+    pipe.render(square(0, 0, 0, 2.0f));
+    pipe.flush();
+    unsigned v = canvas.img[(15 * 40 + 20) * 3];
+    printf("untextured, opacity 0.5 over black: %u\n", v);
+    CHECK(v >= 126 && v <= 129);
+}
+
+int main() {
+    testOrderIndependence();
+    testUntextured();
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures;
+}
\ No newline at end of file